@@ -1,23 +1,67 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
+#include <algorithm>
+#include <functional>
 #include <array>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <atomic>
+#include <bit>
+#include <bitset>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <queue>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
+#if defined(__unix__)||defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define CHIP8_HAVE_POSIX_IO 1  // open/pread/pwrite, mmap: the writer, telemetry, --render, --pipeline
+#define CHIP8_HAVE_FORK 1      // fork/waitpid: --explore
+#endif
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <link.h>
+#define CHIP8_HAVE_JIT 1
+#endif
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#define CHIP8_HAVE_URING 1
+#endif
 
 template <typename T>
 constexpr T clamp(T v, T lo, T hi) { return v < lo ? lo : (v > hi ? hi : v); }
-using u8=uint8_t; using u16=uint16_t; using u32=uint32_t;
+using u8=uint8_t; using u16=uint16_t; using u32=uint32_t; using u64=uint64_t; using i32=int32_t; using i64=int64_t;
 
 namespace chip8c {
   constexpr int kDisplayWidth=64, kDisplayHeight=32, kPixelCount=kDisplayWidth*kDisplayHeight;
-  constexpr int kMemSize=4096; constexpr u16 kEntryAddr=0x200;
+  constexpr int kMemSize=4096; constexpr u16 kEntryAddr=0x200, kAddrMask=kMemSize-1;
   constexpr int kRegCount=16, kStackDepth=16, kTimerHz=60, kKeyCount=16, kGlyphBytes=5;
   constexpr std::array<u8,16*kGlyphBytes> kFontSprites={
     0xF0,0x90,0x90,0x90,0xF0, 0x20,0x60,0x20,0x20,0x70, 0xF0,0x10,0xF0,0x80,0xF0, 0xF0,0x10,0xF0,0x10,0xF0,
@@ -27,6 +71,59 @@ namespace chip8c {
   };
 }
 
+constexpr u64 fnv1a(const u8* p,size_t n,u64 h=1469598103934665603ull){ for(size_t i=0;i<n;++i){ h^=p[i]; h*=1099511628211ull; } return h; }
+// splitmix64: small, seedable and identical everywhere, so runs with the same seed are reproducible.
+struct Rng{
+  u64 s;
+  explicit Rng(u64 seed=0x2545F4914F6CDD1Dull):s(seed){}
+  u64 next(){ u64 z=(s+=0x9E3779B97F4A7C15ull); z=(z^(z>>30))*0xBF58476D1CE4E5B9ull; z=(z^(z>>27))*0x94D049BB133111EBull; return z^(z>>31); }
+  u32 below(u32 n){ return u32(((next()>>32)*n)>>32); }
+  // Seed for job `index` of a batch: depends only on the master seed and the index, never on scheduling.
+  static u64 jobSeed(u64 master,u64 index){ return Rng(master+index*0xD1B54A32D192ED03ull).next(); }
+};
+
+// Build with -DCHIP8_ALLOC_COUNT to count heap allocations per phase (load, frame, step, render).
+namespace allocstat {
+  enum Phase{ kOther, kLoad, kFrame, kStep, kRender, kPhaseCount };
+  constexpr const char* kPhaseNames[kPhaseCount]={"other","load","frame","step","render"};
+  inline std::atomic<u64> counts[kPhaseCount]{}; inline thread_local Phase phase=kOther;
+  inline void note(){ counts[phase].fetch_add(1,std::memory_order_relaxed); }
+  inline u64 get(Phase p){ return counts[p].load(std::memory_order_relaxed); }
+  struct Scope{ Phase prev; explicit Scope(Phase p):prev(phase){ phase=p; } ~Scope(){ phase=prev; } };
+}
+#ifdef CHIP8_ALLOC_COUNT
+#define CHIP8_ALLOC_CAT2(a,b) a##b
+#define CHIP8_ALLOC_CAT(a,b) CHIP8_ALLOC_CAT2(a,b)
+#define CHIP8_ALLOC_PHASE(p) allocstat::Scope CHIP8_ALLOC_CAT(allocScope_,__LINE__)(allocstat::p)
+#if defined(__GLIBC__)
+extern "C" void* __libc_malloc(size_t); extern "C" void* __libc_calloc(size_t,size_t); extern "C" void* __libc_realloc(void*,size_t);
+extern "C" void* malloc(size_t n){ allocstat::note(); return __libc_malloc(n); }
+extern "C" void* calloc(size_t c,size_t n){ allocstat::note(); return __libc_calloc(c,n); }
+extern "C" void* realloc(void* p,size_t n){ allocstat::note(); return __libc_realloc(p,n); }
+// Aligned allocations (alignas(64) types through aligned operator new included) come through these.
+extern "C" void* __libc_memalign(size_t,size_t);
+extern "C" void* memalign(size_t a,size_t n){ allocstat::note(); return __libc_memalign(a,n); }
+extern "C" void* aligned_alloc(size_t a,size_t n){ allocstat::note(); return __libc_memalign(a,n); }
+extern "C" int posix_memalign(void** out,size_t a,size_t n){
+  if(a<sizeof(void*) || (a&(a-1))) return EINVAL;
+  allocstat::note(); void* p=__libc_memalign(a,n); if(!p && n) return ENOMEM; *out=p; return 0;
+}
+#else
+void* operator new(size_t n){ allocstat::note(); if(void* p=std::malloc(n?n:1)) return p; throw std::bad_alloc(); }
+void* operator new[](size_t n){ return operator new(n); }
+void operator delete(void* p)noexcept{ std::free(p); } void operator delete[](void* p)noexcept{ std::free(p); }
+void operator delete(void* p,size_t)noexcept{ std::free(p); } void operator delete[](void* p,size_t)noexcept{ std::free(p); }
+void* operator new(size_t n,std::align_val_t a){
+  allocstat::note(); size_t al=size_t(a); if(void* p=std::aligned_alloc(al,(std::max<size_t>(n,1)+al-1)/al*al)) return p; throw std::bad_alloc();
+}
+void* operator new[](size_t n,std::align_val_t a){ return operator new(n,a); }
+void operator delete(void* p,std::align_val_t)noexcept{ std::free(p); } void operator delete[](void* p,std::align_val_t)noexcept{ std::free(p); }
+void operator delete(void* p,size_t,std::align_val_t)noexcept{ std::free(p); } void operator delete[](void* p,size_t,std::align_val_t)noexcept{ std::free(p); }
+#endif
+#else
+#define CHIP8_ALLOC_PHASE(p) ((void)0)
+#endif
+
 class Display {
  public:
   struct Config{ std::string title="Chip8 VM"; int w=chip8c::kDisplayWidth,h=chip8c::kDisplayHeight,sx=12,sy=12; bool vsync=true; };
@@ -66,6 +163,8 @@ class Keypad {
  private: std::array<bool,chip8c::kKeyCount> keys{};
 };
 
+class Jit;
+
 class Chip8VM {
  public:
   struct FB{ std::array<u8,chip8c::kPixelCount> pix{}; void clear(){ pix.fill(0);} u8& at(int x,int y){return pix[y*chip8c::kDisplayWidth+x];} };
@@ -73,20 +172,58 @@ class Chip8VM {
     std::array<u8,chip8c::kMemSize> mem{}; std::array<u8,chip8c::kRegCount> v{}; u16 I=0, pc=chip8c::kEntryAddr;
     std::array<u16,chip8c::kStackDepth> stack{}; u8 sp=0, DT=0, ST=0;
   };
+  enum class Engine{ Step, Fast, Jit, Tiered };
+  enum Tier{ kCold, kWarm, kHot, kTierCount };
+  static constexpr const char* kTierNames[kTierCount]={"cold","warm","hot"};
+  struct Stats{
+    u64 instructions=0, dispatches=0, fused=0, loopSkipped=0, memoHits=0, memoMisses=0, memoVerified=0, memoMismatches=0, memWrites=0;
+    std::array<u64,kTierCount> tierInstructions{}, tierNanos{};
+  };
+  // Everything that determines future execution. restore() keeps the page table and re-decodes only the pages
+  // whose bytes differ, so it never takes the shared-code registry lock.
+  struct Snapshot{ State st; FB fb; bool waitKey=false; u8 waitReg=0; Rng rng; };
   Chip8VM(){ reset(); }
+  ~Chip8VM();
   void reset(){
-    st=State{}; fb.clear();
+    const std::array<u8,chip8c::kMemSize> before=st.mem; st=State{}; fb.clear();
     constexpr u16 fontAddr=0x050; for(size_t i=0;i<chip8c::kFontSprites.size();++i) st.mem[fontAddr+i]=chip8c::kFontSprites[i];
+    if(!shared){ invalidateAll(); return; }
+    syncCode(changedPages(before,st.mem)); halted=false; resumeAt=-1;
   }
   bool load(const std::string& path){
-    std::ifstream f(path, std::ios::binary); if(!f){ std::cerr<<"ROM open fail: "<<path<<"\n"; return false; }
-    std::vector<u8> bytes((std::istreambuf_iterator<char>(f)),{});
-    if(chip8c::kEntryAddr+bytes.size()>st.mem.size()){ std::cerr<<"ROM too big\n"; return false; }
-    for(size_t i=0;i<bytes.size();++i) st.mem[chip8c::kEntryAddr+i]=bytes[i];
-    st.pc=chip8c::kEntryAddr; return true;
+    CHIP8_ALLOC_PHASE(kLoad);
+    std::ifstream f(path, std::ios::binary|std::ios::ate); if(!f){ std::cerr<<"ROM open fail: "<<path<<"\n"; return false; }
+    std::streamoff n=f.tellg(); if(n<0){ std::cerr<<"ROM read fail: "<<path<<"\n"; return false; }
+    if(size_t(n)>st.mem.size()-chip8c::kEntryAddr){ std::cerr<<"ROM too big\n"; return false; }
+    f.seekg(0); f.read(reinterpret_cast<char*>(&st.mem[chip8c::kEntryAddr]), n);
+    if(!f){ std::cerr<<"ROM read fail: "<<path<<"\n"; return false; }
+    st.pc=chip8c::kEntryAddr; invalidateAll(); romHash=fnv1a(&st.mem[chip8c::kEntryAddr],st.mem.size()-chip8c::kEntryAddr); return true;
+  }
+  bool loadImage(const u8* data,size_t n){
+    if(n>st.mem.size()-chip8c::kEntryAddr){ std::cerr<<"ROM too big\n"; return false; }
+    std::memcpy(&st.mem[chip8c::kEntryAddr],data,n); st.pc=chip8c::kEntryAddr; invalidateAll();
+    romHash=fnv1a(&st.mem[chip8c::kEntryAddr],st.mem.size()-chip8c::kEntryAddr); return true;
+  }
+  // CXNN draws from this generator instead of rand(), so each VM's random stream depends only on its seed.
+  void seed(u64 s){ rng=Rng(s); }
+  u64 rngState()const{ return rng.s; }
+  u64 imageHash()const{ return romHash; }
+  Snapshot snapshot()const{ return Snapshot{st,fb,waitKey,waitReg,rng}; }
+  void restore(const Snapshot& s){
+    const std::bitset<kPages> changed=changedPages(st.mem,s.st.mem);
+    st=s.st; fb=s.fb; waitKey=s.waitKey; waitReg=s.waitReg; rng=s.rng; syncCode(changed); halted=false; resumeAt=-1;
+  }
+  // restore() from another VM's snapshot that also takes over that VM's shared pages, for workers started from a
+  // loaded image: they share its decoded code without each going to the registry.
+  void cloneFrom(const Chip8VM& o){
+    if(!o.shared || o.shared==shared){ restore(o.snapshot()); romHash=o.romHash; return; }
+    st=o.st; fb=o.fb; waitKey=o.waitKey; waitReg=o.waitReg; rng=o.rng; romHash=o.romHash;
+    shared=o.shared; sharedPages.reset(); heat.fill(0); if(memo) memo->clear(); jitFlush();
+    std::bitset<kPages> all; all.set(); syncCode(all); halted=false; resumeAt=-1;
   }
   bool step(Keypad& k){
-    u16 op=(st.mem[st.pc]<<8)|st.mem[st.pc+1]; st.pc+=2;
+    CHIP8_ALLOC_PHASE(kStep);
+    u16 a=st.pc&chip8c::kAddrMask; u16 op=(st.mem[a]<<8)|st.mem[(a+1)&chip8c::kAddrMask]; st.pc+=2;
     u16 nnn=op&0x0FFF; u8 nn=op&0xFF, n=op&0xF, x=(op>>8)&0xF, y=(op>>4)&0xF; bool draw=false;
     switch(op&0xF000){
       case 0x0000: if(nn==0xE0){ fb.clear(); draw=true; } else if(nn==0xEE){ if(st.sp){ st.pc=st.stack[--st.sp]; } } break;
@@ -112,15 +249,8 @@ class Chip8VM {
       case 0x9000: if((op&0xF)==0 && st.v[x]!=st.v[y]) st.pc+=2; break;
       case 0xA000: st.I=nnn; break;
       case 0xB000: st.pc=nnn+st.v[0]; break;
-      case 0xC000: st.v[x]=u8((rand()&0xFF)&nn); break;
-      case 0xD000:{
-        u8 px=st.v[x]%chip8c::kDisplayWidth, py=st.v[y]%chip8c::kDisplayHeight; st.v[0xF]=0;
-        for(u8 row=0; row<n; ++row){ u8 sprite=st.mem[st.I+row];
-          for(u8 col=0; col<8; ++col){ if(sprite&(0x80>>col)){
-              int sx=(px+col)%chip8c::kDisplayWidth, sy=(py+row)%chip8c::kDisplayHeight; u8& p=fb.at(sx,sy);
-              if(p==1) st.v[0xF]=1; p^=1;
-          }}
-        } draw=true; } break;
+      case 0xC000: st.v[x]=u8(random()&nn); break;
+      case 0xD000: draw=sprite(x,y,n); break;
       case 0xE000:
         if(nn==0x9E){ if(k.down(st.v[x])) st.pc+=2; }
         else if(nn==0xA1){ if(!k.down(st.v[x])) st.pc+=2; }
@@ -133,48 +263,2976 @@ class Chip8VM {
           case 0x18: st.ST=st.v[x]; break;
           case 0x1E: st.I=u16(st.I+st.v[x]); break;
           case 0x29: st.I=u16(0x050+(st.v[x]&0xF)*chip8c::kGlyphBytes); break;
-          case 0x33:{ u8 v=st.v[x]; st.mem[st.I]=v/100; st.mem[st.I+1]=(v/10)%10; st.mem[st.I+2]=v%10; }break;
-          case 0x55: for(u8 i=0;i<=x;++i) st.mem[st.I+i]=st.v[i]; break;
-          case 0x65: for(u8 i=0;i<=x;++i) st.v[i]=st.mem[st.I+i]; break;
+          case 0x33: bcd(x); break;
+          case 0x55: storeRegs(x); break;
+          case 0x65: loadRegs(x); break;
         } break;
     }
     return draw;
   }
-  void timerTick(){ if(st.DT>0) --st.DT; if(st.ST>0){ --st.ST; if(st.ST>0) std::cout<<"BEEP\n"; } }
+  // Same semantics as step(), but dispatches over predecoded (and fused) instructions; returns true if anything drew.
+  bool runFast(Keypad& k,int cycles){
+    bool draw=false; int left=cycles;
+    while(left>0){
+      u16 a=st.pc&chip8c::kAddrMask; if(slot(a).kind==kUndecoded) decodeAt(a);
+      const Decoded& d=slot(a); u8 kind=d.kind; ++stats.dispatches;
+      if(coverage) coverage->set(a);
+      if(kind>=kFirstFused && (left<fusedLen(kind) || coverage)) kind=d.base;
+      if(kind>=kFirstFused){ ++stats.fused;
+        switch(kind){
+          case kFuseIdxDraw: st.I=d.nnn; st.pc+=4; left-=2; draw|=sprite(d.x2,d.y2,d.n2,!vfDead(d,left)); break;
+          case kFuseLdLd: st.v[d.x]=d.nn; st.v[d.x2]=d.nn2; st.pc+=4; left-=2; break;
+          case kFuseCountLoop:
+            st.v[d.x]=u8(st.v[d.x]+d.nn);
+            if(st.v[d.x]==d.nn2){ st.pc+=6; left-=2; } else { st.pc=d.nnn; left-=3; left-=skipLoop(a,d,left); }
+            break;
+          case kFuseCountLoopNe:
+            st.v[d.x]=u8(st.v[d.x]+d.nn); left-=3;
+            if(st.v[d.x]==d.nn2) st.pc=fetch(a+4)&0x0FFF; else { st.pc=d.nnn; left-=skipLoop(a,d,left); }
+            break;
+          case kFuseBcdLoad:
+            st.pc+=2; left-=1; bcd(d.x);
+            if(slot(a).kind!=kFuseBcdLoad) break;
+            st.pc+=2; left-=1; loadRegs(d.x2); break;
+          case kFuseFontDraw: st.I=u16(0x050+(st.v[d.x]&0xF)*chip8c::kGlyphBytes); st.pc+=4; left-=2; draw|=sprite(d.x2,d.y2,d.n2,!vfDead(d,left)); break;
+        }
+        continue;
+      }
+      st.pc+=2; --left;
+      switch(kind){
+        case kCls: fb.clear(); draw=true; break;
+        case kRet: if(st.sp){ st.pc=st.stack[--st.sp]; } break;
+        case kJp: st.pc=d.nnn; break;
+        case kCall:
+          if(memo && !debugging() && st.sp<chip8c::kStackDepth){ int used=memoCall(k,d.nnn,left); if(used>=0){ left-=used; break; } }
+          if(st.sp<chip8c::kStackDepth){ st.stack[st.sp++]=st.pc; st.pc=d.nnn; } break;
+        case kSeImm: if(st.v[d.x]==d.nn) st.pc+=2; break;
+        case kSneImm: if(st.v[d.x]!=d.nn) st.pc+=2; break;
+        case kSeReg: if(st.v[d.x]==st.v[d.y]) st.pc+=2; break;
+        case kSneReg: if(st.v[d.x]!=st.v[d.y]) st.pc+=2; break;
+        case kLdImm: st.v[d.x]=d.nn; break;
+        case kAddImm: st.v[d.x]=u8(st.v[d.x]+d.nn); break;
+        case kMov: st.v[d.x]=st.v[d.y]; break;
+        case kOr: st.v[d.x]|=st.v[d.y]; break;
+        case kAnd: st.v[d.x]&=st.v[d.y]; break;
+        case kXor: st.v[d.x]^=st.v[d.y]; break;
+        case kAdd:
+          if(vfDead(d,left)) st.v[d.x]=u8(st.v[d.x]+st.v[d.y]);
+          else { u16 s=st.v[d.x]+st.v[d.y]; st.v[0xF]=s>0xFF; st.v[d.x]=u8(s); }
+          break;
+        case kSub:
+          if(vfDead(d,left)) st.v[d.x]-=st.v[d.y];
+          else { st.v[0xF]=st.v[d.x]>st.v[d.y]; st.v[d.x]-=st.v[d.y]; }
+          break;
+        case kShr:
+          if(vfDead(d,left)) st.v[d.x]>>=1;
+          else { st.v[0xF]=st.v[d.x]&1; st.v[d.x]>>=1; }
+          break;
+        case kSubn:
+          if(vfDead(d,left)) st.v[d.x]=u8(st.v[d.y]-st.v[d.x]);
+          else { st.v[0xF]=st.v[d.y]>st.v[d.x]; st.v[d.x]=u8(st.v[d.y]-st.v[d.x]); }
+          break;
+        case kShl:
+          if(vfDead(d,left)) st.v[d.x]<<=1;
+          else { st.v[0xF]=(st.v[d.x]&0x80)>>7; st.v[d.x]<<=1; }
+          break;
+        case kLdIdx: st.I=d.nnn; break;
+        case kJpV0: st.pc=d.nnn+st.v[0]; break;
+        case kRnd: st.v[d.x]=u8(random()&d.nn); break;
+        case kDraw: draw|=sprite(d.x,d.y,d.n,!vfDead(d,left)); break;
+        case kSkp: if(k.down(st.v[d.x])) st.pc+=2; break;
+        case kSknp: if(!k.down(st.v[d.x])) st.pc+=2; break;
+        case kLdDt: st.v[d.x]=st.DT; break;
+        case kWaitKey: waitKey=true; waitReg=d.x; if(blockOnWait){ cycles-=left; left=0; } break;
+        case kSetDt: st.DT=st.v[d.x]; break;
+        case kSetSt: st.ST=st.v[d.x]; break;
+        case kAddIdx: st.I=u16(st.I+st.v[d.x]); break;
+        case kFont: st.I=u16(0x050+(st.v[d.x]&0xF)*chip8c::kGlyphBytes); break;
+        case kBcd: bcd(d.x); break;
+        case kStore: storeRegs(d.x); break;
+        case kLoad: loadRegs(d.x); break;
+        case kTrap:
+          st.pc=a; ++left;
+          if(trap(a)){ cycles-=left; left=0; break; }
+          draw|=step(k); --left; if(blocked()){ cycles-=left; left=0; } break;
+        default: break;
+      }
+    }
+    stats.instructions+=u64(cycles-left);
+    return draw;
+  }
+  // Native translation of hot regions (x86-64 Linux); elsewhere it is the fast engine.
+  bool runJit(Keypad& k,int cycles);
+  // Cold code is interpreted with step(); an address run warmAt times moves to the fast engine, hotAt times to the JIT.
+  // All tiers share State, so execution moves between them at any instruction. Writing code demotes it to cold.
+  bool runTiered(Keypad& k,int cycles);
+  // Keeps JIT translations and the heat profile of the loaded ROM in dir, keyed by ROM hash, engine version and quirk
+  // profile. Call after load(); returns true if a valid entry was found. Cached code runs as is, so dir must be trusted.
+  bool openTranslationCache(const std::string& dir);
+  bool saveTranslationCache();
+  void setTierThresholds(u16 warm,u16 hot){ warmAt=std::max<u16>(warm,1); hotAt=std::max(hot,warmAt); }
+  // By default FX0A only latches the next fed key into VX and execution goes on; with blocking waits every engine
+  // stops right after FX0A and runs nothing until feedKey().
+  void setBlockingKeyWait(bool on){ blockOnWait=on; }
+  bool waitingForKey()const{ return waitKey; }
+  bool blocked()const{ return waitKey && blockOnWait; }
+  bool run(Keypad& k,int cycles){
+    halted=false; if(blocked()) return false;
+    if(engine==Engine::Fast) return runFast(k,cycles);
+    if(engine==Engine::Jit||engine==Engine::Tiered){
+      bool draw=engine==Engine::Jit?runJit(k,cycles):runTiered(k,cycles);
+      if(coverage) jitCoverage();
+      return draw;
+    }
+    bool draw=false; int i=0;
+    for(;i<cycles && !blocked();++i){
+      u16 a=st.pc&chip8c::kAddrMask; if(!bps.empty() && breaks.test(a) && trap(a)) break;
+      if(coverage) coverage->set(a);
+      draw|=step(k);
+    }
+    stats.instructions+=u64(i); stats.dispatches+=u64(i); return draw;
+  }
+  void timerTick(){ if(st.DT>0) --st.DT; if(st.ST>0){ --st.ST; if(st.ST>0 && beep) std::cout<<"BEEP\n"; } }
+  void setBeep(bool on){ beep=on; }
+  // Marks every executed instruction address in `pcs` while set. Every engine keeps running: the fast engine marks each
+  // dispatch and stops fusing, translations are recompiled to mark the instructions of each block as it is entered,
+  // and memoised calls are off.
+  void trackCoverage(std::bitset<chip8c::kMemSize>* pcs){ coverage=pcs; jitFlush(); }
+  // The engine run() uses: Jit turns into Fast where no translation can be made.
+  Engine activeEngine()const{ return engine; }
+  static const char* engineName(Engine e){ return e==Engine::Step?"step":e==Engine::Fast?"fast":e==Engine::Jit?"jit":"tiered"; }
+  // run() stops before the instruction at a breakpoint (pc left on it, atBreakpoint() set) if its condition, when
+  // given, holds there; the next run() executes that instruction and goes on. The breakpoint is a trap handler put
+  // in the predecoded slot, fused sequences spanning it fall back to single instructions and JIT regions end before
+  // it, so other addresses run as before. Breakpoints survive reset(), load() and restore().
+  using BreakCondition=std::function<bool(const State&)>;
+  void setBreakpoint(u16 addr,BreakCondition cond={}){
+    addr&=chip8c::kAddrMask; auto it=std::find_if(bps.begin(),bps.end(),[&](const Breakpoint& b){ return b.addr==addr; });
+    if(it!=bps.end()) it->cond=std::move(cond); else bps.push_back(Breakpoint{addr,std::move(cond),0});
+    breaks.set(addr); patchBreakpoint(addr); jitFlush();
+  }
+  bool clearBreakpoint(u16 addr){
+    addr&=chip8c::kAddrMask; auto it=std::find_if(bps.begin(),bps.end(),[&](const Breakpoint& b){ return b.addr==addr; });
+    if(it==bps.end()) return false;
+    bps.erase(it); breaks.reset(addr); patchBreakpoint(addr); jitFlush(); if(resumeAt==addr) resumeAt=-1; return true;
+  }
+  bool atBreakpoint()const{ return halted; }
+  u64 breakpointHits(u16 addr)const{ for(const Breakpoint& b:bps) if(b.addr==addr) return b.hits; return 0; }
+  // Memory watchpoints: each watched byte that DXYN or FX65 reads, or FX33 or FX55 writes, is passed to the handler
+  // with the instruction's pc and the byte before and after, ahead of the write. Accesses first test a bitmap of
+  // watched 64-byte pages, so unwatched pages cost one bit test. Instruction fetches are not reported (predecoded
+  // engines do not fetch); use a breakpoint for those.
+  enum WatchKind: u8{ kWatchRead=1, kWatchWrite=2 };
+  struct WatchHit{ u16 pc, addr; u8 kind, before, after; };
+  using WatchHandler=std::function<void(const WatchHit&)>;
+  void watchMemory(u16 addr,int len,u8 kinds){
+    for(int i=0;i<len;++i){
+      u16 a=(addr+i)&chip8c::kAddrMask;
+      if(kinds&kWatchRead){ readWatch.set(a); readPages.set(a>>kPageBits); }
+      if(kinds&kWatchWrite){ writeWatch.set(a); writePages.set(a>>kPageBits); }
+    }
+  }
+  void clearWatches(){ readWatch.reset(); writeWatch.reset(); readPages.reset(); writePages.reset(); }
+  void onWatch(WatchHandler h){ watchHandler=std::move(h); }
   void feedKey(u8 k){ if(waitKey){ st.v[waitReg]=k; waitKey=false; } }
+  bool frame(Keypad& k,int cycles){ bool draw=run(k,cycles); timerTick(); return draw; }
+  u64 stateHash()const{
+    u64 h=fnv1a(st.mem.data(),st.mem.size()); h=fnv1a(st.v.data(),st.v.size(),h);
+    const u16 w[]={st.I,st.pc,st.sp,st.DT,st.ST}; h=fnv1a(reinterpret_cast<const u8*>(w),sizeof w,h);
+    return fnv1a(reinterpret_cast<const u8*>(st.stack.data()),sizeof st.stack,h);
+  }
+  u64 fbHash()const{ return fnv1a(fb.pix.data(),fb.pix.size()); }
+  void setEngine(Engine e){ engine=e; }
+  // Memoise calls to subroutines that only touch registers, I and a few memory bytes (fast engine only). Routines
+  // that draw, read keys or timers, or use CXNN are never cached, and an entry point that misses Memo::kGiveUp times
+  // in a row is dropped, since a miss replays the call through step(); most sprite-heavy ROMs therefore gain little.
+  // Every verifyEvery-th hit is re-executed and checked against the cached result; 0 never verifies.
+  void enableMemo(int verifyEvery){ memo=std::make_unique<Memo>(); memo->verifyEvery=verifyEvery; }
+  static std::optional<Engine> engineByName(std::string_view n){
+    if(n=="step") return Engine::Step;
+    if(n=="fast") return Engine::Fast;
+    if(n=="jit") return Engine::Jit;
+    if(n=="tiered") return Engine::Tiered;
+    return std::nullopt;
+  }
+  const Stats& statistics()const{ return stats; }
   const FB& framebuffer()const{ return fb; }
+  const State& state()const{ return st; }
+  static std::string disasm(u16 op){
+    char b[24]; u16 nnn=op&0x0FFF; u8 nn=op&0xFF, n=op&0xF, x=(op>>8)&0xF, y=(op>>4)&0xF;
+    static constexpr const char* alu[16]={"LD","OR","AND","XOR","ADD","SUB","SHR","SUBN",nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,"SHL",nullptr};
+    std::snprintf(b,sizeof b,"DW %04X",op);
+    switch(op&0xF000){
+      case 0x0000: if(op==0x00E0) return "CLS"; if(op==0x00EE) return "RET"; std::snprintf(b,sizeof b,"SYS %03X",nnn); break;
+      case 0x1000: std::snprintf(b,sizeof b,"JP %03X",nnn); break;
+      case 0x2000: std::snprintf(b,sizeof b,"CALL %03X",nnn); break;
+      case 0x3000: std::snprintf(b,sizeof b,"SE V%X, %02X",x,nn); break;
+      case 0x4000: std::snprintf(b,sizeof b,"SNE V%X, %02X",x,nn); break;
+      case 0x5000: if(!n) std::snprintf(b,sizeof b,"SE V%X, V%X",x,y); break;
+      case 0x6000: std::snprintf(b,sizeof b,"LD V%X, %02X",x,nn); break;
+      case 0x7000: std::snprintf(b,sizeof b,"ADD V%X, %02X",x,nn); break;
+      case 0x8000: if(alu[n]) std::snprintf(b,sizeof b,"%s V%X, V%X",alu[n],x,y); break;
+      case 0x9000: if(!n) std::snprintf(b,sizeof b,"SNE V%X, V%X",x,y); break;
+      case 0xA000: std::snprintf(b,sizeof b,"LD I, %03X",nnn); break;
+      case 0xB000: std::snprintf(b,sizeof b,"JP V0, %03X",nnn); break;
+      case 0xC000: std::snprintf(b,sizeof b,"RND V%X, %02X",x,nn); break;
+      case 0xD000: std::snprintf(b,sizeof b,"DRW V%X, V%X, %X",x,y,n); break;
+      case 0xE000: if(nn==0x9E||nn==0xA1) std::snprintf(b,sizeof b,nn==0x9E?"SKP V%X":"SKNP V%X",x); break;
+      default:{
+        const char* f=nn==0x07?"LD V%X, DT":nn==0x0A?"LD V%X, K":nn==0x15?"LD DT, V%X":nn==0x18?"LD ST, V%X":nn==0x1E?"ADD I, V%X":
+                      nn==0x29?"LD F, V%X":nn==0x33?"LD B, V%X":nn==0x55?"LD [I], V%X":nn==0x65?"LD V%X, [I]":nullptr;
+        if(f) std::snprintf(b,sizeof b,f,x);
+      }
+    }
+    return b;
+  }
+ private:
+  enum Kind: u8 {
+    kUndecoded, kNop, kCls, kRet, kJp, kCall, kSeImm, kSneImm, kSeReg, kSneReg, kLdImm, kAddImm,
+    kMov, kOr, kAnd, kXor, kAdd, kSub, kShr, kSubn, kShl, kLdIdx, kJpV0, kRnd, kDraw, kSkp, kSknp,
+    kLdDt, kWaitKey, kSetDt, kSetSt, kAddIdx, kFont, kBcd, kStore, kLoad, kTrap,
+    kFirstFused, kFuseIdxDraw=kFirstFused, kFuseLdLd, kFuseCountLoop, kFuseCountLoopNe, kFuseBcdLoad, kFuseFontDraw
+  };
+  // x2..nn2 describe the second instruction of a fused sequence; counted loops keep their jump target in nnn.
+  // vfKill: the VF this instruction (or a fused DXYN) writes is overwritten unread that many instructions later.
+  struct Decoded{ u8 kind=kUndecoded, base=kUndecoded, x=0, y=0, n=0, nn=0; u16 nnn=0; u8 x2=0, y2=0, n2=0, nn2=0, vfKill=0; };
+  static int fusedLen(u8 kind){ return kind==kFuseCountLoop||kind==kFuseCountLoopNe?3:2; }
+  static Decoded decodeOp(u16 op){
+    Decoded d; d.nnn=op&0x0FFF; d.nn=op&0xFF; d.n=op&0xF; d.x=(op>>8)&0xF; d.y=(op>>4)&0xF;
+    u8 k=kNop;
+    switch(op&0xF000){
+      case 0x0000: k=d.nn==0xE0?kCls:d.nn==0xEE?kRet:kNop; break;
+      case 0x1000: k=kJp; break;
+      case 0x2000: k=kCall; break;
+      case 0x3000: k=kSeImm; break;
+      case 0x4000: k=kSneImm; break;
+      case 0x5000: k=d.n==0?kSeReg:kNop; break;
+      case 0x6000: k=kLdImm; break;
+      case 0x7000: k=kAddImm; break;
+      case 0x8000:{ static constexpr u8 alu[16]={kMov,kOr,kAnd,kXor,kAdd,kSub,kShr,kSubn,kNop,kNop,kNop,kNop,kNop,kNop,kShl,kNop}; k=alu[d.n]; }break;
+      case 0x9000: k=d.n==0?kSneReg:kNop; break;
+      case 0xA000: k=kLdIdx; break;
+      case 0xB000: k=kJpV0; break;
+      case 0xC000: k=kRnd; break;
+      case 0xD000: k=kDraw; break;
+      case 0xE000: k=d.nn==0x9E?kSkp:d.nn==0xA1?kSknp:kNop; break;
+      case 0xF000:
+        switch(d.nn){
+          case 0x07: k=kLdDt; break; case 0x0A: k=kWaitKey; break; case 0x15: k=kSetDt; break; case 0x18: k=kSetSt; break;
+          case 0x1E: k=kAddIdx; break; case 0x29: k=kFont; break; case 0x33: k=kBcd; break; case 0x55: k=kStore; break; case 0x65: k=kLoad; break;
+        } break;
+    }
+    d.kind=d.base=k; return d;
+  }
+  u16 fetch(u16 a)const{ return u16((st.mem[a&chip8c::kAddrMask]<<8)|st.mem[(a+1)&chip8c::kAddrMask]); }
+  void decodeAt(u16 a){ slot(a)=decodeFrom(a); if(!bps.empty()) fence(a); }
+  // Nothing fused or VF-elided reaches over a breakpoint, so a stop sees what the reference engine would.
+  void fence(u16 a){
+    Decoded& d=slot(a);
+    for(int i=1;i<8;++i) if(breaks.test((a+i)&chip8c::kAddrMask)){ if(d.kind>=kFirstFused) d.kind=d.base; d.vfKill=0; break; }
+    if(breaks.test(a)) d.kind=kTrap;
+  }
+  // Re-decodes every slot that can reach addr, which installs or removes its trap. Breakpoints count as warm so the
+  // tiered engine never runs them with step().
+  void patchBreakpoint(u16 addr){
+    for(int a=int(addr)-7;a<=int(addr);++a){ u16 m=a&chip8c::kAddrMask; if(sharedPages.test(m>>kPageBits)) privatize(m>>kPageBits); decodeAt(m); }
+    warmBreakpoints();
+  }
+  void warmBreakpoints(){ for(const Breakpoint& b:bps) heat[b.addr]=std::max(heat[b.addr],warmAt); }
+  // The trap handler: true if the run stops at a. The stop is resumed by executing the instruction at a once.
+  bool trap(u16 a){
+    if(resumeAt==a){ resumeAt=-1; return false; }
+    for(Breakpoint& b:bps) if(b.addr==a){
+      if(b.cond && !b.cond(st)) return false;
+      ++b.hits; halted=true; resumeAt=a; return true;
+    }
+    return false;
+  }
+  Decoded decodeFrom(u16 a)const{
+    Decoded d=decodeOp(fetch(a));
+    if(a+8<=chip8c::kMemSize){
+      Decoded b=decodeOp(fetch(a+2)), c=decodeOp(fetch(a+4)), e=decodeOp(fetch(a+6)); auto pair=[&](u8 kind){ d.kind=kind; d.x2=b.x; d.y2=b.y; d.n2=b.n; d.nn2=b.nn; };
+      if(d.base==kLdIdx && b.base==kDraw) pair(kFuseIdxDraw);
+      else if(d.base==kLdImm && b.base==kLdImm) pair(kFuseLdLd);
+      else if(d.base==kAddImm && b.base==kSeImm && b.x==d.x && c.base==kJp){ pair(kFuseCountLoop); d.nnn=c.nnn; }
+      else if(d.base==kAddImm && b.base==kSneImm && b.x==d.x && c.base==kJp && e.base==kJp){ pair(kFuseCountLoopNe); d.nnn=e.nnn; }
+      else if(d.base==kBcd && b.base==kLoad) pair(kFuseBcdLoad);
+      else if(d.base==kFont && b.base==kDraw) pair(kFuseFontDraw);
+      const Decoded next[]={b,c,e};
+      if((d.kind==kFuseIdxDraw||d.kind==kFuseFontDraw) && writesFlag(kDraw,d.x2,d.y2)) d.vfKill=u8(vfKillDistance(next+1,2));
+      else if(d.kind==d.base && writesFlag(d.base,d.x,d.y)) d.vfKill=u8(vfKillDistance(next,3));
+    }
+    return d;
+  }
+  // Instructions that write VF as a side result; with VX or VY being VF the result itself depends on the new VF.
+  static bool writesFlag(u8 kind,u8 x,u8 y){ return (kind==kAdd||kind==kSub||kind==kShr||kind==kSubn||kind==kShl||kind==kDraw) && x!=0xF && y!=0xF; }
+  // Registers (bit 16: I) an instruction reads and writes, including through helpers. With leaves() this is the one
+  // account of instruction effects; the fast engine's VF liveness and BlockIr's passes are both built on it.
+  static void effects(const Decoded& d,u32& rd,u32& wr){
+    regUse(d,rd,wr);
+    switch(d.base){
+      case kDraw: rd|=1u<<d.x|1u<<d.y|1u<<16; wr|=1u<<0xF; break;
+      case kRnd: case kLdDt: wr|=1u<<d.x; break;
+      case kSkp: case kSknp: case kSetDt: case kSetSt: rd|=1u<<d.x; break;
+      default: break;
+    }
+  }
+  // Instructions after which every register must be assumed live: they may leave straight-line code, or they write
+  // memory, which could rewrite the instructions that follow.
+  static bool leaves(u8 kind){
+    switch(kind){
+      case kJp: case kCall: case kRet: case kJpV0: case kSeImm: case kSneImm: case kSeReg: case kSneReg:
+      case kSkp: case kSknp: case kBcd: case kStore: case kWaitKey: case kUndecoded: return true;
+      default: return false;
+    }
+  }
+  // What an instruction does to VF: 1 overwrites it without reading, 0 leaves it alone, -1 reads it or leaves().
+  static int vfFate(const Decoded& d){
+    if(leaves(d.base)) return -1;
+    u32 rd=0, wr=0; effects(d,rd,wr);
+    return rd>>0xF&1?-1:wr>>0xF&1?1:0;
+  }
+  // Position (1-based) of the first of next[0..n) that overwrites VF before anything reads it; 0 if VF stays live.
+  static int vfKillDistance(const Decoded* next,int n){
+    for(int i=0;i<n;++i){ int f=vfFate(next[i]); if(f<0) return 0; if(f>0) return i+1; }
+    return 0;
+  }
+  // A write at addr can change the instruction starting there or one byte before, and any fused head up to 7 bytes before.
+  void invalidate(u16 addr,int len){
+    for(int a=int(addr)-7;a<int(addr)+len;++a){
+      u16 m=a&chip8c::kAddrMask; if(sharedPages.test(m>>kPageBits)) privatize(m>>kPageBits);
+      slot(m).kind=kUndecoded; heat[m]=0;
+    }
+    if(!bps.empty()) warmBreakpoints();
+    if(memo) memo->codeWritten(addr,len);
+    jitCodeWritten(addr,len); ++stats.memWrites;
+  }
+  // Called when a counted loop headed at `head` has just jumped back to st.pc. If the body [pc,head) only sets or adds
+  // registers other than the counter, whole iterations are applied arithmetically, as many as fit in `left`
+  // without reaching the exiting one; the rest runs normally. Returns the instructions accounted for.
+  int skipLoop(u16 head,const Decoded& d,int left){
+    constexpr int kMaxBody=8; u16 t=st.pc;
+    if(t>head || (head-t)%2 || (head-t)/2>kMaxBody) return 0;
+    int body=(head-t)/2, iter=body+3; if(left<2*iter) return 0;
+    std::array<u8,chip8c::kRegCount> add{}, set{}; u16 setMask=0;
+    for(u16 p=t;p<head;p+=2){
+      if(slot(p).kind==kUndecoded) decodeAt(p);
+      const Decoded& b=slot(p); if(b.x==d.x || b.kind==kTrap || (b.base!=kLdImm && b.base!=kAddImm)) return 0;
+      if(b.base==kLdImm){ set[b.x]=b.nn; add[b.x]=0; setMask|=1u<<b.x; } else add[b.x]=u8(add[b.x]+b.nn);
+    }
+    u8 c=st.v[d.x]; int exitAt=iterationsUntil(c,d.nn,d.nn2);
+    int m=std::min(exitAt-1,left/iter); if(m<=0) return 0;
+    st.v[d.x]=u8(c+d.nn*m);
+    for(int r=0;r<chip8c::kRegCount;++r) st.v[r]=(setMask>>r)&1?u8(set[r]+add[r]):u8(st.v[r]+add[r]*m);
+    stats.loopSkipped+=u64(m)*iter; return m*iter;
+  }
+  // Smallest j>=1 with c+kk*j == target (mod 256), or INT_MAX when the counter never gets there.
+  static int iterationsUntil(u8 c,u8 kk,u8 target){
+    u8 diff=u8(target-c); if(kk==0) return diff==0?1:INT_MAX;
+    int tz=__builtin_ctz(kk); if(diff&((1u<<tz)-1)) return INT_MAX;
+    u32 mod=256u>>tz, odd=u32(kk>>tz), inv=odd; for(int i=0;i<3;++i) inv*=2-odd*inv;
+    u32 j=(u32(diff>>tz)*inv)&(mod-1); return j?int(j):int(mod);
+  }
+  void invalidateAll(){
+    attachCode(); heat.fill(0); if(memo) memo->clear(); jitFlush();
+    halted=false; resumeAt=-1; for(const Breakpoint& b:bps) patchBreakpoint(b.addr);
+  }
+  // Decoded instructions are kept per 64-byte page. Pages of an image first seen by load() are decoded once and
+  // shared read-only by every VM holding the same image; a VM that writes into a page, or the 7 bytes before it,
+  // switches that page to a private copy. Nothing is ever invalidated globally.
+  static constexpr int kPageBits=6, kPageSize=1<<kPageBits, kPages=chip8c::kMemSize/kPageSize;
+  using CodePage=std::array<Decoded,kPageSize>;
+  struct SharedCode{ std::array<u8,chip8c::kMemSize> image; std::array<CodePage,kPages> pages; };
+  // Private copies live at fixed places in a per-VM reserve of kPages pages set up with the VM, so privatising never
+  // allocates or locks. On POSIX the reserve is anonymous mmap memory and only pages made private become resident,
+  // so a batch's footprint stays its shared tables plus the pages it has written.
+  struct Reserve{
+    CodePage* pages=nullptr;
+    Reserve(){
+#ifdef CHIP8_HAVE_POSIX_IO
+      void* p=mmap(nullptr,sizeof(CodePage)*kPages,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+      if(p!=MAP_FAILED){ pages=static_cast<CodePage*>(p); mapped=true; return; }
+#endif
+      pages=new CodePage[kPages];
+    }
+    ~Reserve(){
+#ifdef CHIP8_HAVE_POSIX_IO
+      if(mapped){ munmap(pages,sizeof(CodePage)*kPages); return; }
+#endif
+      delete[] pages;
+    }
+    Reserve(const Reserve&)=delete; Reserve& operator=(const Reserve&)=delete;
+    bool mapped=false;
+  };
+  Decoded& slot(u16 a){ return pages[a>>kPageBits][a&(kPageSize-1)]; }
+  void privatize(int p){ CodePage* c=new(&reserve.pages[p]) CodePage(shared->pages[p]); pages[p]=c->data(); sharedPages.reset(p); }
+  // Like privatize(), for a page whose every slot is about to be decoded again.
+  void privatizeUndecoded(int p){
+    CodePage* c=new(&reserve.pages[p]) CodePage; pages[p]=c->data(); sharedPages.reset(p);
+  }
+  void share(int p){ pages[p]=const_cast<Decoded*>(shared->pages[p].data()); sharedPages.set(p); }
+  // Brings the page table in line with memory that changed in `changed` pages without going back to the registry:
+  // a page whose bytes (and the 7 after it) are the shared image's again goes back to the shared copy, any other
+  // page it touches is made private and left to decode lazily.
+  void syncCode(const std::bitset<kPages>& changed){
+    if(changed.none()) return;
+    std::bitset<kPages> touched=changed|(changed>>1); if(changed.test(0)) touched.set(kPages-1);
+    for(int p=0;p<kPages;++p){
+      if(!touched.test(p)) continue;
+      int at=p*kPageSize, next=((p+1)%kPages)*kPageSize;
+      bool same=!std::memcmp(&st.mem[at],&shared->image[at],kPageSize) && !std::memcmp(&st.mem[next],&shared->image[next],7);
+      if(same){ if(!sharedPages.test(p)) share(p); } else privatizeUndecoded(p);
+      if(changed.test(p)){ if(memo) memo->codeWritten(u16(at),kPageSize); jitCodeWritten(u16(at),kPageSize); }
+    }
+    for(const Breakpoint& b:bps) patchBreakpoint(b.addr);
+  }
+  static std::bitset<kPages> changedPages(const std::array<u8,chip8c::kMemSize>& a,const std::array<u8,chip8c::kMemSize>& b){
+    std::bitset<kPages> c; for(int p=0;p<kPages;++p) if(std::memcmp(&a[p*kPageSize],&b[p*kPageSize],kPageSize)) c.set(p);
+    return c;
+  }
+  void attachCode(){
+    static std::mutex lock; static std::unordered_map<u64,std::weak_ptr<const SharedCode>> registry;
+    u64 h=fnv1a(st.mem.data(),st.mem.size()); std::shared_ptr<const SharedCode> sc;
+    {
+      std::lock_guard<std::mutex> g(lock); auto& w=registry[h]; sc=w.lock();
+      if(sc && sc->image!=st.mem) sc.reset();
+      if(!sc){
+        auto fresh=std::make_shared<SharedCode>(); fresh->image=st.mem;
+        for(int a=0;a<chip8c::kMemSize;++a) fresh->pages[a>>kPageBits][a&(kPageSize-1)]=decodeFrom(u16(a));
+        w=fresh; sc=std::move(fresh);
+        if(registry.size()>256) for(auto it=registry.begin();it!=registry.end();) it=it->second.expired()?registry.erase(it):std::next(it);
+      }
+    }
+    shared=std::move(sc);
+    for(int p=0;p<kPages;++p) share(p);
+  }
+  Jit* jitReady(Keypad& k); bool ensureJit();
+  void jitCodeWritten(u16 addr,int len); void jitFlush(); void jitCoverage();
+  // The VF write of the current instruction is dead if the instruction that overwrites it still runs in this budget.
+  static bool vfDead(const Decoded& d,int left){ return d.vfKill && left>=d.vfKill; }
+  // With collide=false (VF dead) pixels are only flipped and VF is left alone.
+  bool sprite(u8 x,u8 y,u8 n,bool collide=true){
+    if(pageWatched(readPages,st.I,n)) watchRead(n);
+    u8 px=st.v[x]%chip8c::kDisplayWidth, py=st.v[y]%chip8c::kDisplayHeight; if(collide) st.v[0xF]=0;
+    for(u8 row=0; row<n; ++row){ u8 bits=st.mem[(st.I+row)&chip8c::kAddrMask];
+      for(u8 col=0; col<8; ++col){ if(bits&(0x80>>col)){
+          int sx=(px+col)%chip8c::kDisplayWidth, sy=(py+row)%chip8c::kDisplayHeight; u8& p=fb.at(sx,sy);
+          if(collide && p==1) st.v[0xF]=1;
+          p^=1;
+      }}
+    } return true;
+  }
+  void bcd(u8 x){ u8 v=st.v[x]; const u8 d[3]={u8(v/100),u8((v/10)%10),u8(v%10)}; writeMem(d,3); }
+  void storeRegs(u8 x){ writeMem(st.v.data(),x+1); }
+  void loadRegs(u8 x){ if(pageWatched(readPages,st.I,x+1)) watchRead(x+1); for(u8 i=0;i<=x;++i) st.v[i]=st.mem[(st.I+i)&chip8c::kAddrMask]; }
+  void writeMem(const u8* src,int n){
+    if(pageWatched(writePages,st.I,n)) watchWrite(src,n);
+    for(int i=0;i<n;++i) st.mem[(st.I+i)&chip8c::kAddrMask]=src[i];
+    invalidate(st.I,n);
+  }
+  // Accesses are at most 16 bytes from I, so they touch at most two pages. The current instruction is at pc-2.
+  static bool pageWatched(const std::bitset<kPages>& pages,u16 at,int n){
+    return pages.test((at&chip8c::kAddrMask)>>kPageBits) || pages.test(((at+n-1)&chip8c::kAddrMask)>>kPageBits);
+  }
+  void watchRead(int n){
+    for(int i=0;i<n;++i){ u16 a=(st.I+i)&chip8c::kAddrMask; if(readWatch.test(a) && watchHandler) watchHandler(WatchHit{u16((st.pc-2)&chip8c::kAddrMask),a,kWatchRead,st.mem[a],st.mem[a]}); }
+  }
+  void watchWrite(const u8* src,int n){
+    for(int i=0;i<n;++i){ u16 a=(st.I+i)&chip8c::kAddrMask; if(writeWatch.test(a) && watchHandler) watchHandler(WatchHit{u16((st.pc-2)&chip8c::kAddrMask),a,kWatchWrite,st.mem[a],src[i]}); }
+  }
+  // Memoised calls skip the instructions they stand for, so they are off while anything observes execution.
+  bool debugging()const{ return !bps.empty() || readPages.any() || writePages.any() || coverage; }
+  u8 random(){ return u8(rng.next()>>56); }
+  // Cached subroutine calls keyed by entry point plus the registers (bit 16: I) the routine read before writing.
+  struct Memo{
+    static constexpr int kEntries=512, kMaxFoot=16, kMaxInstr=64, kGiveUp=16; static constexpr u32 kIBit=1u<<16;
+    struct Entry{
+      bool valid=false; u8 count=0, nReads=0, nWrites=0; u16 entry=0, I=0, outI=0; u32 inMask=0, outMask=0;
+      std::array<u8,chip8c::kRegCount> in{}, out{}; std::array<u16,kMaxFoot> rdAddr{}, wrAddr{}; std::array<u8,kMaxFoot> rdVal{}, wrVal{};
+    };
+    std::array<Entry,kEntries> table{}; std::array<u32,chip8c::kMemSize> mask{}; std::array<u8,chip8c::kMemSize> misses{};
+    std::bitset<chip8c::kMemSize> seen, impure, code;
+    int verifyEvery=0; u64 sinceVerify=0; bool flushed=false;
+    void clear(){ drop(); misses.fill(0); }
+    // Miss streaks survive a code write, so a routine that keeps rewriting cached code is still given up on.
+    void drop(){ for(auto& e:table) e.valid=false; mask.fill(0); seen.reset(); impure.reset(); code.reset(); flushed=true; }
+    void codeWritten(u16 a,int len){ for(int i=0;i<len;++i) if(code.test((a+i)&chip8c::kAddrMask)){ drop(); return; } }
+    static size_t slot(u16 entry,u32 m,const std::array<u8,chip8c::kRegCount>& v,u16 I){
+      u64 h=fnv1a(reinterpret_cast<const u8*>(&entry),sizeof entry); h=fnv1a(reinterpret_cast<const u8*>(&m),sizeof m,h);
+      for(int r=0;r<chip8c::kRegCount;++r) if(m>>r&1) h=fnv1a(&v[r],1,h);
+      if(m&kIBit) h=fnv1a(reinterpret_cast<const u8*>(&I),sizeof I,h);
+      return h%kEntries;
+    }
+    static bool matches(const Entry& e,const State& s){
+      for(int r=0;r<chip8c::kRegCount;++r) if((e.inMask>>r&1) && e.in[r]!=s.v[r]) return false;
+      if((e.inMask&kIBit) && e.I!=s.I) return false;
+      for(int i=0;i<e.nReads;++i) if(s.mem[e.rdAddr[i]]!=e.rdVal[i]) return false;
+      return true;
+    }
+  };
+  static bool memoPure(u8 kind){
+    switch(kind){ case kCls: case kCall: case kRnd: case kDraw: case kSkp: case kSknp: case kLdDt: case kWaitKey: case kSetDt: case kSetSt: case kUndecoded: return false; default: return true; }
+  }
+  // Registers (bit 16: I) an instruction reads and writes.
+  static void regUse(const Decoded& d,u32& rd,u32& wr){
+    auto R=[&](int r){ rd|=1u<<r; }; auto W=[&](int r){ wr|=1u<<r; }; constexpr int kI=16;
+    switch(d.base){
+      case kSeImm: case kSneImm: R(d.x); break;
+      case kSeReg: case kSneReg: R(d.x); R(d.y); break;
+      case kLdImm: W(d.x); break;
+      case kAddImm: R(d.x); W(d.x); break;
+      case kMov: R(d.y); W(d.x); break;
+      case kOr: case kAnd: case kXor: R(d.x); R(d.y); W(d.x); break;
+      case kAdd: case kSub: case kSubn: R(d.x); R(d.y); W(0xF); W(d.x); break;
+      case kShr: case kShl: R(d.x); W(0xF); W(d.x); break;
+      case kLdIdx: W(kI); break;
+      case kJpV0: R(0); break;
+      case kAddIdx: R(d.x); R(kI); W(kI); break;
+      case kFont: R(d.x); W(kI); break;
+      case kBcd: R(d.x); R(kI); break;
+      case kStore: for(int r=0;r<=d.x;++r) R(r); R(kI); break;
+      case kLoad: R(kI); for(int r=0;r<=d.x;++r) W(r); break;
+      default: break;
+    }
+  }
+  // Handles a call whose return address is already in st.pc. Returns the instructions run after the call itself,
+  // or -1 for a plain call.
+  int memoCall(Keypad& k,u16 target,int left){
+    Memo& M=*memo; target&=chip8c::kAddrMask; if(M.impure.test(target)) return -1;
+    if(M.seen.test(target)){
+      u32 m=M.mask[target]; const Memo::Entry& e=M.table[Memo::slot(target,m,st.v,st.I)];
+      if(e.valid && e.entry==target && e.inMask==m && e.count-1<=left && Memo::matches(e,st)){
+        if(M.verifyEvery && ++M.sinceVerify>=u64(M.verifyEvery)){ M.sinceVerify=0; return verifyMemo(k,e,left); }
+        M.misses[target]=0; ++stats.memoHits; applyMemo(e); return e.count-1;
+      }
+    }
+    ++stats.memoMisses; if(++M.misses[target]>=Memo::kGiveUp){ M.impure.set(target); return -1; }
+    bool done=false; return recordCall(k,target,left,done);
+  }
+  void applyMemo(const Memo::Entry& e){
+    st.stack[st.sp]=st.pc;
+    for(int r=0;r<chip8c::kRegCount;++r) if(e.outMask>>r&1) st.v[r]=e.out[r];
+    if(e.outMask&Memo::kIBit) st.I=e.outI;
+    for(int i=0;i<e.nWrites;++i){ st.mem[e.wrAddr[i]]=e.wrVal[i]; invalidate(e.wrAddr[i],1); }
+  }
+  // Performs the call with step() while recording its footprint; caches it if it returns within budget and bounds.
+  int recordCall(Keypad& k,u16 target,int left,bool& done){
+    Memo& M=*memo; Memo::Entry e; e.entry=target; const auto v0=st.v; const u16 I0=st.I;
+    st.stack[st.sp++]=st.pc; st.pc=target; M.flushed=false;
+    u32 written=0; int used=0; bool overflow=false;
+    while(used<left){
+      if(used>=Memo::kMaxInstr){ M.impure.set(target); break; }
+      u16 pc=st.pc&chip8c::kAddrMask; Decoded dd=decodeOp(fetch(pc));
+      if(!memoPure(dd.base)){ M.impure.set(target); break; }
+      u32 rd=0, wr=0; regUse(dd,rd,wr); e.inMask|=rd&~written; written|=wr;
+      M.code.set(pc); M.code.set((pc+1)&chip8c::kAddrMask);
+      if(dd.base==kLoad) for(int i=0;i<=dd.x;++i){
+        u16 a=(st.I+i)&chip8c::kAddrMask; bool own=false; for(int w=0;w<e.nWrites;++w) own|=e.wrAddr[w]==a;
+        if(own) continue;
+        if(e.nReads==Memo::kMaxFoot){ overflow=true; break; }
+        e.rdAddr[e.nReads]=a; e.rdVal[e.nReads++]=st.mem[a];
+      }
+      if(overflow){ M.impure.set(target); break; }
+      u16 Ipre=st.I; step(k); ++used;
+      if(dd.base==kBcd||dd.base==kStore) for(int i=0;i<(dd.base==kBcd?3:dd.x+1);++i){
+        u16 a=(Ipre+i)&chip8c::kAddrMask; int w=0; while(w<e.nWrites && e.wrAddr[w]!=a) ++w;
+        if(w==Memo::kMaxFoot){ overflow=true; break; }
+        e.wrAddr[w]=a; e.wrVal[w]=st.mem[a]; if(w==e.nWrites) ++e.nWrites;
+      }
+      if(overflow){ M.impure.set(target); break; }
+      if(M.flushed) break;
+      if(dd.base==kRet){ done=true; break; }
+    }
+    M.seen.set(target);
+    if(done){
+      M.mask[target]|=e.inMask; e.inMask=M.mask[target];
+      for(int r=0;r<chip8c::kRegCount;++r){ e.in[r]=v0[r]; if(written>>r&1) e.out[r]=st.v[r]; }
+      e.I=I0; e.outI=st.I; e.outMask=written; e.count=u8(used+1); e.valid=true;
+      M.table[Memo::slot(target,e.inMask,v0,I0)]=e;
+    }
+    return used;
+  }
+  int verifyMemo(Keypad& k,const Memo::Entry& cached,int left){
+    const Memo::Entry e=cached; const State before=st; applyMemo(e); const State replayed=st; st=before;
+    bool done=false; int used=recordCall(k,e.entry,left,done); ++stats.memoVerified;
+    if(done && (st.mem!=replayed.mem || st.v!=replayed.v || st.I!=replayed.I || st.pc!=replayed.pc || st.stack!=replayed.stack)){
+      ++stats.memoMismatches; std::cerr<<"memo mismatch in sub_"<<std::hex<<e.entry<<std::dec<<"\n";
+    }
+    return used;
+  }
+  State st{}; FB fb{}; bool waitKey=false, blockOnWait=false, beep=true; u8 waitReg=0; Rng rng; std::bitset<chip8c::kMemSize>* coverage=nullptr;
+  std::unique_ptr<Memo> memo;
+  struct Breakpoint{ u16 addr; BreakCondition cond; u64 hits; };
+  std::vector<Breakpoint> bps; std::bitset<chip8c::kMemSize> breaks; bool halted=false; int resumeAt=-1;
+  std::bitset<kPages> readPages, writePages; std::bitset<chip8c::kMemSize> readWatch, writeWatch; WatchHandler watchHandler;
+  friend class Jit; friend class BlockIr; std::unique_ptr<Jit> jit;
+  Engine engine=Engine::Tiered; Stats stats{};
+  std::array<Decoded*,kPages> pages{}; std::shared_ptr<const SharedCode> shared; Reserve reserve; std::bitset<kPages> sharedPages;
+  std::array<u16,chip8c::kMemSize> heat{}; u16 warmAt=4, hotAt=64;
+  u64 romHash=0; std::string cachePath;
+};
+
+// Block IR: the decoded instructions of one basic block as register transfers with explicit operands (register 16
+// is I). Each instruction keeps the index of the guest instruction it came from, so a backend still counts and exits
+// exactly. The passes track what each register holds through the block (a constant, a copy of another register or
+// unknown), which is local value numbering; instructions are rewritten in place and backends emit what is left.
+// All registers are assumed live at the block end and at anything that can leave it mid-way (FX0A/FX33/FX55).
+class BlockIr {
+ public:
+  using V=Chip8VM; using Decoded=Chip8VM::Decoded;
+  static constexpr int kMaxIns=64, kRegI=16, kRegs=17; static constexpr u32 kAll=(1u<<kRegs)-1;
+  struct Ins{ Decoded d; u8 orig=0; bool flag=true; };    // flag=false: the VF result of 8XY4..8XYE/DXYN is dead
+  void lift(const Decoded* ops,int count,u16 start){ n=0; base=start; for(int i=0;i<count && n<kMaxIns/2;++i) ins[n++]=Ins{ops[i],u8(i),true}; }
+  void optimise(){ constants(); copies(); deadStores(); }
+  int size()const{ return n; }
+  const Ins& operator[](int i)const{ return ins[i]; }
+ private:
+  static Decoded constant(int r,u32 v){
+    Decoded c; if(r==kRegI){ c.kind=c.base=V::kLdIdx; c.nnn=u16(v); } else { c.kind=c.base=V::kLdImm; c.x=u8(r); c.nn=u8(v); }
+    return c;
+  }
+  static Decoded jump(u16 to){ Decoded c; c.kind=c.base=V::kJp; c.nnn=to; return c; }
+  // 8XY4..8XYE on concrete values, exactly as Chip8VM::step does them.
+  static void alu(u8 kind,std::array<u8,chip8c::kRegCount>& v,u8 x,u8 y){
+    switch(kind){
+      case V::kAdd:{ u16 s=v[x]+v[y]; v[0xF]=s>0xFF; v[x]=u8(s); }break;
+      case V::kSub:{ v[0xF]=v[x]>v[y]; v[x]-=v[y]; }break;
+      case V::kShr:{ v[0xF]=v[x]&1; v[x]>>=1; }break;
+      case V::kSubn:{ v[0xF]=v[y]>v[x]; v[x]=u8(v[y]-v[x]); }break;
+      case V::kShl:{ v[0xF]=(v[x]&0x80)>>7; v[x]<<=1; }break;
+    }
+  }
+  // Constant propagation and folding (6XNN then 7XNN, ALU ops on known values, ANNN then FX1E/FX29), including
+  // skips whose outcome is known, which become jumps.
+  void constants(){
+    std::array<Ins,kMaxIns> out; int m=0; std::array<i32,kRegs> val; val.fill(-1);
+    auto known=[&](int r){ return val[r]>=0; };
+    auto put=[&](const Ins& at,const Decoded& d){ Ins c=at; c.d=d; out[m++]=c; };
+    for(int i=0;i<n;++i){
+      const Ins& s=ins[i]; const Decoded& d=s.d; u16 a=u16(base+2*s.orig);
+      switch(d.base){
+        case V::kLdImm: put(s,d); val[d.x]=d.nn; continue;
+        case V::kLdIdx: put(s,d); val[kRegI]=d.nnn; continue;
+        case V::kAddImm: if(known(d.x)){ val[d.x]=u8(val[d.x]+d.nn); put(s,constant(d.x,u32(val[d.x]))); continue; } break;
+        case V::kMov: if(known(d.y)){ val[d.x]=val[d.y]; put(s,constant(d.x,u32(val[d.x]))); continue; } break;
+        case V::kOr: case V::kAnd: case V::kXor:
+          if(known(d.x) && known(d.y)){
+            u8 l=u8(val[d.x]), r=u8(val[d.y]); val[d.x]=d.base==V::kOr?l|r:d.base==V::kAnd?l&r:l^r; put(s,constant(d.x,u32(val[d.x]))); continue;
+          } break;
+        case V::kAdd: case V::kSub: case V::kSubn: case V::kShr: case V::kShl:
+          if(known(d.x) && (known(d.y) || d.base==V::kShr || d.base==V::kShl)){
+            std::array<u8,chip8c::kRegCount> t{}; t[d.x]=u8(val[d.x]); if(known(d.y)) t[d.y]=u8(val[d.y]);
+            alu(d.base,t,d.x,d.y); val[0xF]=t[0xF]; put(s,constant(0xF,t[0xF]));
+            if(d.x!=0xF){ val[d.x]=t[d.x]; put(s,constant(d.x,t[d.x])); }
+            continue;
+          } break;
+        case V::kAddIdx: if(known(d.x) && known(kRegI)){ val[kRegI]=u16(val[kRegI]+val[d.x]); put(s,constant(kRegI,u32(val[kRegI]))); continue; } break;
+        case V::kFont: if(known(d.x)){ val[kRegI]=0x050+(val[d.x]&0xF)*chip8c::kGlyphBytes; put(s,constant(kRegI,u32(val[kRegI]))); continue; } break;
+        case V::kSeImm: case V::kSneImm:
+          if(known(d.x)){ bool eq=val[d.x]==d.nn; put(s,jump(u16(a+((eq==(d.base==V::kSeImm))?4:2)))); continue; } break;
+        case V::kSeReg: case V::kSneReg:
+          if(known(d.x) && known(d.y)){ bool eq=val[d.x]==val[d.y]; put(s,jump(u16(a+((eq==(d.base==V::kSeReg))?4:2)))); continue; } break;
+      }
+      put(s,d); u32 rd=0, wr=0; V::effects(d,rd,wr);
+      for(int r=0;r<kRegs;++r) if(wr>>r&1) val[r]=-1;
+    }
+    ins=out; n=m;
+  }
+  // Copy propagation: after 8XY0, later reads of VX that only read it use VY while both are unchanged. A move that
+  // copies a register onto itself disappears.
+  void copies(){
+    std::array<Ins,kMaxIns> out; int m=0; std::array<i32,kRegs> copy; copy.fill(-1);
+    auto src=[&](u8& r){ if(copy[r]>=0) r=u8(copy[r]); };
+    for(int i=0;i<n;++i){
+      Ins s=ins[i]; Decoded& d=s.d;
+      switch(d.base){
+        case V::kMov: case V::kOr: case V::kAnd: case V::kXor: case V::kAdd: case V::kSub: case V::kSubn: src(d.y); break;
+        case V::kSeImm: case V::kSneImm: case V::kSetDt: case V::kSetSt: case V::kAddIdx: case V::kFont: src(d.x); break;
+        case V::kSeReg: case V::kSneReg: src(d.x); src(d.y); break;
+      }
+      if(d.base==V::kMov && d.x==d.y) continue;
+      out[m++]=s; u32 rd=0, wr=0; V::effects(d,rd,wr);
+      for(int r=0;r<kRegs;++r) if(wr>>r&1){ copy[r]=-1; for(auto& c:copy) if(c==r) c=-1; }
+      if(d.base==V::kMov) copy[d.x]=d.y;
+    }
+    ins=out; n=m;
+  }
+  // Register-only instructions whose results are all overwritten before being read are dropped; for flag-writing
+  // ones whose VF alone is dead, only the flag computation goes (flag=false).
+  void deadStores(){
+    u32 live=kAll; std::bitset<kMaxIns> drop;
+    for(int i=n-1;i>=0;--i){
+      Ins& s=ins[i]; const Decoded& d=s.d; u32 rd=0, wr=0; V::effects(d,rd,wr);
+      if(V::leaves(d.base)){ live=kAll; continue; }
+      if(regOnly(d.base) && !(wr&live)){ drop.set(i); continue; }
+      if(V::writesFlag(d.base,d.x,d.y) && !(live>>0xF&1)){ s.flag=false; wr&=~(1u<<0xF); }
+      live=(live&~wr)|rd;
+    }
+    int m=0; for(int i=0;i<n;++i) if(!drop.test(i)) ins[m++]=ins[i];
+    n=m;
+  }
+  // Instructions with no effect beyond their register writes; FX65 is not one, since its memory reads are observable
+  // through read watchpoints.
+  static bool regOnly(u8 kind){
+    switch(kind){
+      case V::kNop: case V::kLdImm: case V::kAddImm: case V::kMov: case V::kOr: case V::kAnd: case V::kXor: case V::kAdd: case V::kSub:
+      case V::kSubn: case V::kShr: case V::kShl: case V::kLdIdx: case V::kAddIdx: case V::kFont: case V::kLdDt: return true;
+      default: return false;
+    }
+  }
+  std::array<Ins,kMaxIns> ins{}; int n=0; u16 base=0;
+};
+
+#ifdef CHIP8_HAVE_JIT
+// x86-64 translator. A region is a set of basic blocks reachable from an entry pc through jumps and skips; blocks
+// inside a region branch to each other directly, and the most used V registers (and I) stay pinned in host
+// registers for the whole region. They are written back only at exits and around helper calls (DXYN, FX33, ...).
+class Jit {
+ public:
+  struct Ctx;
+  using Helper=u32(*)(Ctx*,u32 op,u32 addr);
+  enum HelperId{ hCls, hDraw, hBlit, hRnd, hKey, hWait, hBcd, hStore, hLoad, hCall, hRet, hJpV0, kHelperCount };
+  // seen: instruction addresses run by translations compiled while coverage is tracked, folded in after run().
+  struct Ctx{
+    Chip8VM::State* st=nullptr; Chip8VM* vm=nullptr; Keypad* keys=nullptr; Helper helpers[kHelperCount]{}; i32 left=0; u8 draw=0;
+    std::array<u64,chip8c::kMemSize/64> seen{};
+  };
+  using Fn=void(*)(Ctx*);
+  static constexpr size_t kArenaSize=1<<20, kMaxRegionCode=32<<10;
+  static constexpr int kMaxBlocks=24, kMaxOps=128, kMaxBlockOps=32, kMaxPatches=256, kMaxRegions=2048;
+  // Bump kCacheVersion whenever generated code changes; kQuirks names the only instruction semantics this VM has.
+  static constexpr u32 kCacheVersion=5, kQuirks=0;
+
+  Jit(){
+    void* p=mmap(nullptr,kArenaSize,PROT_READ|PROT_WRITE|PROT_EXEC,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if(p!=MAP_FAILED) arena=static_cast<u8*>(p);
+    entry.fill(nullptr); cached.fill(0);
+    ctx.helpers[hCls]=&Jit::cls; ctx.helpers[hDraw]=&Jit::draw; ctx.helpers[hBlit]=&Jit::blit; ctx.helpers[hRnd]=&Jit::rnd; ctx.helpers[hKey]=&Jit::key;
+    ctx.helpers[hWait]=&Jit::wait; ctx.helpers[hBcd]=&Jit::bcd; ctx.helpers[hStore]=&Jit::store; ctx.helpers[hLoad]=&Jit::load;
+    ctx.helpers[hCall]=&Jit::call; ctx.helpers[hRet]=&Jit::ret; ctx.helpers[hJpV0]=&Jit::jpv0;
+  }
+  ~Jit(){ closeCache(); if(arena) munmap(arena,kArenaSize); }
+  Jit(const Jit&)=delete; Jit& operator=(const Jit&)=delete;
+  bool ok()const{ return arena!=nullptr; }
+  // Translation for pc, compiling it on first use; nullptr if pc is not translatable.
+  Fn lookup(Chip8VM& vm,u16 pc){
+    if(pc+6>chip8c::kMemSize) return nullptr;
+    if(!entry[pc]){
+      if(rejected.test(pc)) return nullptr;
+      if(used+kMaxRegionCode>kArenaSize) flush();
+      if((!vm.bps.empty() || vm.coverage || !adopt(vm,pc)) && !compile(vm,pc)){ rejected.set(pc); return nullptr; }
+    }
+    return entry[pc];
+  }
+  // Guest memory write: drop every translation if it touched translated code.
+  void codeWritten(u16 addr,int len){
+    for(int i=0;i<len;++i) if(covered.test((addr+i)&chip8c::kAddrMask)){ flush(); dirty=true; return; }
+  }
+  // The arena is only reused once no translation is running (see reclaim()).
+  void flush(){ entry.fill(nullptr); covered.reset(); rejected.reset(); nlive=0; if(running) pendingReset=true; else used=0; }
+  void reclaim(){ if(pendingReset){ used=0; pendingReset=false; } }
+
+  // Cache file: header (with the heat profile), region records, the guest bytes each region was translated from,
+  // then the code at a page boundary. Regions only branch within themselves and reach helpers through Ctx, so the
+  // code runs from wherever the file is mapped. build ties a file to the binary that wrote it, and sum (FNV-1a over
+  // the header with sum=0, records, guest bytes and code) must match before any of its code is run.
+  struct CacheHeader{ char magic[8]; u32 version, quirks, layout, nRegions; u64 rom, guestBytes, codeOff, codeBytes, build, sum; std::array<u16,chip8c::kMemSize> heat; };
+  struct CacheRegion{ u16 pc; u8 nblocks, pad; u32 guestOff, codeOff, codeSize; std::array<u16,kMaxBlocks> start; std::array<u8,kMaxBlocks> count; };
+  static constexpr char kMagic[8]={'C','H','8','J','I','T','\0','\0'};
+  bool openCache(const std::string& path,u64 rom){
+    closeCache();
+    int fd=::open(path.c_str(),O_RDONLY); if(fd<0) return false;
+    struct stat sb{}; size_t n=fstat(fd,&sb)==0?size_t(sb.st_size):0; void* p=MAP_FAILED;
+    if(n>=sizeof(CacheHeader)){ p=mmap(nullptr,n,PROT_READ|PROT_EXEC,MAP_PRIVATE,fd,0); imageExec=p!=MAP_FAILED; if(!imageExec) p=mmap(nullptr,n,PROT_READ,MAP_PRIVATE,fd,0); }
+    ::close(fd); if(p==MAP_FAILED) return false;
+    image=static_cast<u8*>(p); imageSize=n;
+    if(!validCache(rom)){ std::cerr<<"jit cache: ignoring invalid "<<path<<"\n"; closeCache(); return false; }
+    for(u32 i=0;i<header().nRegions;++i) cached[record(i).pc]=u16(i+1);
+    return true;
+  }
+  void closeCache(){ if(!image) return; flush(); munmap(image,imageSize); image=nullptr; imageSize=0; cached.fill(0); }
+  const std::array<u16,chip8c::kMemSize>* cachedHeat()const{ return image?&header().heat:nullptr; }
+  // Writes the live translations plus cached regions not reached this run; goes through a temporary file and rename().
+  bool saveCache(const std::string& path,u64 rom,const Chip8VM& vm)const{
+    std::vector<Region> out; std::bitset<chip8c::kMemSize> have;
+    for(int i=0;i<nlive;++i) if(!have.test(live[i].pc)){ have.set(live[i].pc); out.push_back(live[i]); }
+    for(u32 i=0;image && i<header().nRegions;++i){
+      const CacheRegion& c=record(i); if(have.test(c.pc)) continue;
+      Region r; r.pc=c.pc; r.nblocks=c.nblocks; r.start=c.start; r.count=c.count; r.code=code()+c.codeOff; r.size=c.codeSize; r.guest=guest()+c.guestOff;
+      have.set(c.pc); out.push_back(r);
+    }
+    CacheHeader h{}; std::memcpy(h.magic,kMagic,sizeof kMagic); h.version=kCacheVersion; h.quirks=kQuirks; h.layout=layout(); h.rom=rom;
+    h.nRegions=u32(out.size()); h.heat=vm.heat; h.build=buildId();
+    std::vector<CacheRegion> recs(out.size()); std::vector<u8> g, c;
+    for(size_t i=0;i<out.size();++i){
+      const Region& r=out[i]; CacheRegion& e=recs[i]; e=CacheRegion{}; e.pc=r.pc; e.nblocks=r.nblocks; e.start=r.start; e.count=r.count; e.guestOff=u32(g.size());
+      for(int b=0;b<r.nblocks;++b){ const u8* src=r.guest?r.guest+(g.size()-e.guestOff):&vm.st.mem[r.start[b]]; g.insert(g.end(),src,src+2*r.count[b]); }
+      e.codeOff=u32(c.size()); e.codeSize=r.size; c.insert(c.end(),r.code,r.code+r.size); c.resize((c.size()+15)&~size_t(15));
+    }
+    size_t recEnd=sizeof h+recs.size()*sizeof(CacheRegion); h.guestBytes=g.size(); h.codeOff=(recEnd+g.size()+4095)&~size_t(4095); h.codeBytes=c.size();
+    u64 sum=fnv1a(reinterpret_cast<const u8*>(&h),sizeof h); sum=fnv1a(reinterpret_cast<const u8*>(recs.data()),recs.size()*sizeof(CacheRegion),sum);
+    sum=fnv1a(g.data(),g.size(),sum); h.sum=fnv1a(c.data(),c.size(),sum);
+    std::string tmp=path+".tmp"+std::to_string(getpid());
+    std::ofstream f(tmp,std::ios::binary|std::ios::trunc);
+    f.write(reinterpret_cast<const char*>(&h),sizeof h); f.write(reinterpret_cast<const char*>(recs.data()),std::streamsize(recs.size()*sizeof(CacheRegion)));
+    f.write(reinterpret_cast<const char*>(g.data()),std::streamsize(g.size()));
+    std::vector<char> pad(h.codeOff-recEnd-g.size()); f.write(pad.data(),std::streamsize(pad.size()));
+    f.write(reinterpret_cast<const char*>(c.data()),std::streamsize(c.size())); f.close();
+    if(!f || std::rename(tmp.c_str(),path.c_str())!=0){ std::cerr<<"jit cache: cannot write "<<path<<"\n"; std::remove(tmp.c_str()); return false; }
+    return true;
+  }
+  Ctx ctx; bool dirty=false, running=false; u64 regions=0, adopted=0;
+
+ private:
+  enum Reg{ RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+  enum Cond: u8 { kB=2, kAE=3, kE=4, kNE=5, kA=7, kL=0xC };
+  static constexpr int kRegI=16, kGuestRegs=17;
+  static constexpr Reg kPool[]={RBX,RBP,R12,RSI,RDI,R8,R9,R10,R11};
+  static constexpr bool calleeSaved(int r){ return r==RBX||r==RBP||r==R12; }
+
+  // Minimal encoder: memory operands are [r14/r15+disp32], which need no SIB byte; leaScaled() is the one SIB form.
+  struct Asm{
+    u8* p=nullptr;
+    void b(u8 x){ *p++=x; }
+    void d(u32 x){ std::memcpy(p,&x,4); p+=4; }
+    void rex(bool w,int reg,int rm,bool force=false){ u8 r=u8(0x40|(w<<3)|((reg>>3)<<2)|(rm>>3)); if(r!=0x40||force) b(r); }
+    void mem(int reg,int base,i32 disp){ b(u8(0x80|((reg&7)<<3)|(base&7))); d(u32(disp)); }
+    void rr(int reg,int rm){ b(u8(0xC0|((reg&7)<<3)|(rm&7))); }
+    void movzxB(int dst,int base,i32 disp){ rex(false,dst,base); b(0x0F); b(0xB6); mem(dst,base,disp); }
+    void movzxW(int dst,int base,i32 disp){ rex(false,dst,base); b(0x0F); b(0xB7); mem(dst,base,disp); }
+    void storeB(int src,int base,i32 disp){ rex(false,src,base,src>=4); b(0x88); mem(src,base,disp); }
+    void storeW(int src,int base,i32 disp){ b(0x66); rex(false,src,base); b(0x89); mem(src,base,disp); }
+    void load32(int dst,int base,i32 disp){ rex(false,dst,base); b(0x8B); mem(dst,base,disp); }
+    void store32(int src,int base,i32 disp){ rex(false,src,base); b(0x89); mem(src,base,disp); }
+    void load64(int dst,int base,i32 disp){ rex(true,dst,base); b(0x8B); mem(dst,base,disp); }
+    void movRR(int dst,int src){ if(dst!=src){ rex(false,src,dst); b(0x89); rr(src,dst); } }
+    void movRR64(int dst,int src){ rex(true,src,dst); b(0x89); rr(src,dst); }
+    void movImm(int dst,u32 imm){ rex(false,0,dst); b(u8(0xB8|(dst&7))); d(imm); }
+    void movImm64(int dst,u64 imm){ rex(true,0,dst); b(u8(0xB8|(dst&7))); d(u32(imm)); d(u32(imm>>32)); }
+    void orMem64(int base,i32 disp,int src){ rex(true,src,base); b(0x09); mem(src,base,disp); }
+    void alu(u8 opc,int dst,int src){ rex(false,src,dst); b(opc); rr(src,dst); }
+    void aluImm(int ext,int dst,u32 imm){ rex(false,0,dst); b(0x81); rr(ext,dst); d(imm); }
+    void aluImmB(int ext,int base,i32 disp,u8 imm){ rex(false,0,base); b(0x80); mem(ext,base,disp); b(imm); }
+    void movImmB(int base,i32 disp,u8 imm){ rex(false,0,base); b(0xC6); mem(0,base,disp); b(imm); }
+    void movImmW(int base,i32 disp,u16 imm){ b(0x66); rex(false,0,base); b(0xC7); mem(0,base,disp); b(u8(imm)); b(u8(imm>>8)); }
+    void shift(int ext,int dst,u8 n){ rex(false,0,dst); b(0xC1); rr(ext,dst); b(n); }
+    // lea dst32,[base+index<<scale]; base must not be rbp/r13 (their mod=00 form means disp32 instead).
+    void leaScaled(int dst,int base,int index,int scale){
+      u8 r=u8(0x40|((dst>>3)<<2)|((index>>3)<<1)|(base>>3)); if(r!=0x40) b(r);
+      b(0x8D); b(u8(((dst&7)<<3)|4)); b(u8((scale<<6)|((index&7)<<3)|(base&7)));
+    }
+    void setcc(u8 cc,int dst){ rex(false,0,dst,dst>=4); b(0x0F); b(u8(0x90|cc)); rr(0,dst); rex(false,dst,dst,dst>=4); b(0x0F); b(0xB6); rr(dst,dst); }
+    void test(int a,int c){ rex(false,c,a); b(0x85); rr(c,a); }
+    u8* jcc(u8 cc){ b(0x0F); b(u8(0x80|cc)); d(0); return p-4; }
+    u8* jmp(){ b(0xE9); d(0); return p-4; }
+    void callMem(int base,i32 disp){ rex(false,0,base); b(0xFF); mem(2,base,disp); }
+    void push(int r){ if(r>=8) b(0x41); b(u8(0x50|(r&7))); }
+    void pop(int r){ if(r>=8) b(0x41); b(u8(0x58|(r&7))); }
+    static void patch(u8* at,const u8* target){ i32 rel=i32(target-(at+4)); std::memcpy(at,&rel,4); }
+  };
+  enum Term{ kFall, kJump, kSkip, kExit };
+  struct Block{ u16 start=0, next=0; int first=0, count=0; Term term=kFall; u8* label=nullptr; };
+  struct Patch{ u8* at=nullptr; u16 pc=0; int refund=0; };
+  // A translation and the guest blocks it covers; guest is the cached copy of their bytes (nullptr: still in VM memory).
+  struct Region{ u16 pc=0; u8 nblocks=0; std::array<u16,kMaxBlocks> start{}; std::array<u8,kMaxBlocks> count{}; const u8* code=nullptr; u32 size=0; const u8* guest=nullptr; };
+
+  static constexpr i32 offV=offsetof(Chip8VM::State,v), offI=offsetof(Chip8VM::State,I), offPC=offsetof(Chip8VM::State,pc);
+  static constexpr i32 offDT=offsetof(Chip8VM::State,DT), offST=offsetof(Chip8VM::State,ST);
+  static constexpr i32 offLeft=offsetof(Ctx,left), offSt=offsetof(Ctx,st), offHelpers=offsetof(Ctx,helpers), offSeen=offsetof(Ctx,seen);
+
+  static bool ends(u8 kind){
+    using V=Chip8VM; return kind==V::kJp||kind==V::kCall||kind==V::kRet||kind==V::kJpV0||kind==V::kSeImm||kind==V::kSneImm||
+                             kind==V::kSeReg||kind==V::kSneReg||kind==V::kSkp||kind==V::kSknp;
+  }
+
+  bool compile(Chip8VM& vm,u16 start){
+    using V=Chip8VM;
+    std::array<Block,kMaxBlocks> blocks; std::array<Chip8VM::Decoded,kMaxOps> ops; int nb=0, nops=0;
+    std::array<u16,kMaxBlocks> work; int nw=0; work[nw++]=start;
+    auto find=[&](u16 pc)->int{ for(int i=0;i<nb;++i) if(blocks[i].start==pc) return i; return -1; };
+    while(nw>0 && nb<kMaxBlocks && nops<kMaxOps){
+      u16 s=work[--nw]; if(find(s)>=0) continue;
+      Block& bl=blocks[nb++]; bl.start=s; bl.first=nops; u16 a=s;
+      while(true){
+        if(a+6>chip8c::kMemSize || nops==kMaxOps || bl.count==kMaxBlockOps || vm.breaks.test(a)){ bl.term=kFall; break; }
+        Chip8VM::Decoded d=Chip8VM::decodeOp(vm.fetch(a)); ops[nops++]=d; ++bl.count; a+=2;
+        if(ends(d.base)){ bl.term=d.base==Chip8VM::kJp?kJump:(d.base==Chip8VM::kCall||d.base==Chip8VM::kRet||d.base==Chip8VM::kJpV0)?kExit:kSkip; break; }
+      }
+      if(bl.count==0){ --nb; continue; }
+      bl.next=a;
+      auto want=[&](u16 pc){ if(nw<kMaxBlocks && pc+6<=chip8c::kMemSize && find(pc)<0 && !vm.breaks.test(pc)) work[nw++]=pc; };
+      if(bl.term==kFall) want(a); else if(bl.term==kSkip){ want(u16(a+2)); want(a); } else if(bl.term==kJump) want(ops[nops-1].nnn);
+    }
+    if(nb==0) return false;
+    std::array<BlockIr,kMaxBlocks> ir;
+    for(int bi=0;bi<nb;++bi){ ir[bi].lift(&ops[blocks[bi].first],blocks[bi].count,blocks[bi].start); ir[bi].optimise(); }
+
+    // Pin the most referenced guest registers; VF gets a bonus so flag writes stay in a host register.
+    std::array<int,kGuestRegs> uses{}; u32 written=0;
+    for(int bi=0;bi<nb;++bi) for(int i=0;i<ir[bi].size();++i){
+      u32 rd=0, wr=0; Chip8VM::effects(ir[bi][i].d,rd,wr); written|=wr;
+      for(int r=0;r<kGuestRegs;++r) if((rd|wr)>>r&1) ++uses[r];
+    }
+    if(written>>0xF&1) uses[0xF]+=4;
+    host.fill(-1); pinned=0;
+    for(Reg h:kPool){
+      int best=-1; for(int r=0;r<kGuestRegs;++r) if(host[r]<0 && uses[r]>0 && (best<0||uses[r]>uses[best])) best=r;
+      if(best<0) break;
+      host[best]=h; pinned|=1u<<best;
+    }
+    dirtySet=pinned&written;
+
+    Asm as; as.p=arena+used; u8* fn=as.p; const bool track=vm.coverage!=nullptr;
+    std::array<Patch,kMaxPatches> exits; int nexits=0; std::array<std::pair<u8*,u16>,kMaxPatches> links; int nlinks=0;
+    bool overflow=false;
+    auto exitTo=[&](u8* at,u16 pc,int refund){ if(nexits==kMaxPatches){ overflow=true; return; } exits[nexits++]=Patch{at,pc,refund}; };
+    auto branch=[&](u8* at,u16 pc){ if(find(pc)>=0){ if(nlinks==kMaxPatches){ overflow=true; return; } links[nlinks++]={at,pc}; } else exitTo(at,pc,0); };
+
+    for(Reg r:{RBX,RBP,R12,R13,R14,R15}) as.push(r);
+    as.b(0x48); as.b(0x83); as.b(0xEC); as.b(0x08);                  // sub rsp,8 (keeps calls 16-byte aligned)
+    as.movRR64(R14,RDI); as.load64(R15,R14,offSt); as.load32(R13,R14,offLeft);
+    reload(as,pinned);
+    std::array<u8*,kMaxPatches> toTail; std::array<u8*,kMaxBlocks> toRet; int ntoTail=0, ntoRet=0;
+
+    for(int bi=0;bi<nb && !overflow;++bi){
+      Block& bl=blocks[bi]; bl.label=as.p;
+      as.aluImm(7,R13,u32(bl.count)); exitTo(as.jcc(kL),bl.start,0); as.aluImm(5,R13,u32(bl.count));
+      int marked=track?mark(as,&ops[bl.first],bl,0):bl.count;
+      for(int i=0;i<ir[bi].size();++i){
+        const BlockIr::Ins& in=ir[bi][i]; const Chip8VM::Decoded& d=in.d; bool vfDead=!in.flag;
+        u16 a=u16(bl.start+2*in.orig), next=u16(a+2); int refund=bl.count-1-in.orig;
+        switch(d.base){
+          case V::kNop: break;
+          case V::kCls: helper(as,hCls,0,a,0); break;
+          case V::kJp: branch(as.jmp(),d.nnn); break;
+          case V::kCall: case V::kRet: case V::kJpV0:
+            writeback(as); callOut(as,d.base==V::kCall?hCall:d.base==V::kRet?hRet:hJpV0,d.nnn,a);
+            toRet[ntoRet++]=as.jmp(); break;
+          case V::kSeImm: case V::kSneImm:
+            if(host[d.x]>=0) as.aluImm(7,host[d.x],d.nn); else as.aluImmB(7,R15,offV+d.x,d.nn);
+            branch(as.jcc(d.base==V::kSeImm?kE:kNE),u16(next+2)); branch(as.jmp(),next); break;
+          case V::kSeReg: case V::kSneReg:
+            loadV(as,RAX,d.x); loadV(as,RCX,d.y); as.alu(0x39,RAX,RCX);
+            branch(as.jcc(d.base==V::kSeReg?kE:kNE),u16(next+2)); branch(as.jmp(),next); break;
+          case V::kSkp: case V::kSknp:
+            helper(as,hKey,d.x,a,0); as.test(RAX,RAX);
+            branch(as.jcc(d.base==V::kSkp?kNE:kE),u16(next+2)); branch(as.jmp(),next); break;
+          case V::kLdImm: if(host[d.x]>=0) as.movImm(host[d.x],d.nn); else as.movImmB(R15,offV+d.x,d.nn); break;
+          case V::kAddImm:
+            if(host[d.x]>=0){ as.aluImm(0,host[d.x],d.nn); as.aluImm(4,host[d.x],0xFF); } else as.aluImmB(0,R15,offV+d.x,d.nn);
+            break;
+          case V::kMov: loadV(as,RAX,d.y); storeV(as,d.x,RAX); break;
+          case V::kOr: case V::kAnd: case V::kXor:
+            loadV(as,RAX,d.x); loadV(as,RCX,d.y); as.alu(d.base==V::kOr?0x09:d.base==V::kAnd?0x21:0x31,RAX,RCX); storeV(as,d.x,RAX); break;
+          case V::kAdd:
+            loadV(as,RAX,d.x); loadV(as,RCX,d.y); as.alu(0x01,RAX,RCX);
+            if(!vfDead){ as.movRR(RDX,RAX); as.shift(5,RDX,8); storeV(as,0xF,RDX); }
+            as.aluImm(4,RAX,0xFF); storeV(as,d.x,RAX); break;
+          case V::kSub:
+            if(!vfDead){ loadV(as,RAX,d.x); loadV(as,RCX,d.y); as.alu(0x39,RAX,RCX); as.setcc(kA,RDX); storeV(as,0xF,RDX); }
+            loadV(as,RAX,d.x); loadV(as,RCX,d.y); as.alu(0x29,RAX,RCX); as.aluImm(4,RAX,0xFF); storeV(as,d.x,RAX); break;
+          case V::kSubn:
+            if(!vfDead){ loadV(as,RAX,d.x); loadV(as,RCX,d.y); as.alu(0x39,RCX,RAX); as.setcc(kA,RDX); storeV(as,0xF,RDX); }
+            loadV(as,RAX,d.x); loadV(as,RCX,d.y); as.alu(0x29,RCX,RAX); as.aluImm(4,RCX,0xFF); storeV(as,d.x,RCX); break;
+          case V::kShr:
+            if(!vfDead){ loadV(as,RAX,d.x); as.aluImm(4,RAX,1); storeV(as,0xF,RAX); }
+            loadV(as,RAX,d.x); as.shift(5,RAX,1); storeV(as,d.x,RAX); break;
+          case V::kShl:
+            if(!vfDead){ loadV(as,RAX,d.x); as.shift(5,RAX,7); storeV(as,0xF,RAX); }
+            loadV(as,RAX,d.x); as.shift(4,RAX,1); as.aluImm(4,RAX,0xFF); storeV(as,d.x,RAX); break;
+          case V::kLdIdx: if(host[kRegI]>=0) as.movImm(host[kRegI],d.nnn); else as.movImmW(R15,offI,d.nnn); break;
+          case V::kAddIdx: loadV(as,RAX,d.x); loadI(as,RCX); as.alu(0x01,RCX,RAX); as.aluImm(4,RCX,0xFFFF); storeI(as,RCX); break;
+          case V::kFont:
+            loadV(as,RAX,d.x); as.aluImm(4,RAX,0xF); as.leaScaled(RAX,RAX,RAX,2);
+            as.aluImm(0,RAX,0x050); storeI(as,RAX); break;
+          case V::kLdDt: as.movzxB(RAX,R15,offDT); storeV(as,d.x,RAX); break;
+          case V::kSetDt: case V::kSetSt: loadV(as,RAX,d.x); as.storeB(RAX,R15,d.base==V::kSetDt?offDT:offST); break;
+          case V::kRnd: helper(as,hRnd,d.nnn,a,1u<<d.x); break;
+          case V::kDraw: if(vfDead) helper(as,hBlit,d.nnn,a,0); else helper(as,hDraw,d.nnn,a,1u<<0xF); break;
+          case V::kWaitKey: helper(as,hWait,d.x,a,0); as.test(RAX,RAX); exitTo(as.jcc(kNE),next,refund); break;
+          case V::kLoad: helper(as,hLoad,d.x,a,(2u<<d.x)-1); break;
+          case V::kBcd: case V::kStore:
+            helper(as,d.base==V::kBcd?hBcd:hStore,d.x,a,0); as.test(RAX,RAX); exitTo(as.jcc(kNE),next,refund); break;
+          default: exitTo(as.jmp(),a,refund+1); break;
+        }
+        if(in.orig+1==marked && marked<bl.count) marked=mark(as,&ops[bl.first],bl,marked);
+        if(nexits>kMaxPatches-8 || as.p-fn>i32(kMaxRegionCode)-1024) overflow=true;
+      }
+      if(bl.term==kFall) branch(as.jmp(),bl.next);
+    }
+    if(overflow) return false;
+    for(int i=0;i<nexits;++i){
+      Asm::patch(exits[i].at,as.p); as.movImmW(R15,offPC,exits[i].pc);
+      if(exits[i].refund) as.aluImm(0,R13,u32(exits[i].refund));
+      toTail[ntoTail++]=as.jmp();
+      if(as.p-fn>i32(kMaxRegionCode)-256) return false;
+    }
+    for(int i=0;i<ntoTail;++i) Asm::patch(toTail[i],as.p);
+    writeback(as);
+    for(int i=0;i<ntoRet;++i) Asm::patch(toRet[i],as.p);
+    as.store32(R13,R14,offLeft);
+    as.b(0x48); as.b(0x83); as.b(0xC4); as.b(0x08);                  // add rsp,8
+    for(Reg r:{R15,R14,R13,R12,RBP,RBX}) as.pop(r);
+    as.b(0xC3);
+    for(int i=0;i<nlinks;++i) Asm::patch(links[i].first,blocks[find(links[i].second)].label);
+    Region r; r.pc=start; r.nblocks=u8(nb); r.code=fn; r.size=u32(as.p-fn);
+    for(int bi=0;bi<nb;++bi){ r.start[bi]=blocks[bi].start; r.count[bi]=u8(blocks[bi].count); }
+    install(r); used+=size_t(as.p-fn); used=(used+15)&~size_t(15); ++regions;
+    return true;
+  }
+  // Sets the seen bits of the block's instructions from `from` on, up to and including the first one that can leave
+  // the block after running (FX0A/FX33/FX55); returns the index past it.
+  int mark(Asm& as,const Chip8VM::Decoded* ops,const Block& bl,int from){
+    int end=from; u64 bits=0; int word=-1;
+    while(end<bl.count){
+      int a=bl.start+2*end, w=a>>6; u8 kind=ops[end++].base;
+      if(w!=word){ if(bits){ as.movImm64(RAX,bits); as.orMem64(R14,offSeen+word*8,RAX); } word=w; bits=0; }
+      bits|=u64(1)<<(a&63);
+      if(kind==Chip8VM::kWaitKey||kind==Chip8VM::kBcd||kind==Chip8VM::kStore) break;
+    }
+    if(bits){ as.movImm64(RAX,bits); as.orMem64(R14,offSeen+word*8,RAX); }
+    return end;
+  }
+  void install(const Region& r){
+    for(int b=0;b<r.nblocks;++b) for(int i=0;i<r.count[b]*2;++i) covered.set((r.start[b]+i)&chip8c::kAddrMask);
+    entry[r.pc]=reinterpret_cast<Fn>(const_cast<u8*>(r.code));
+    if(nlive<kMaxRegions){ live[nlive]=r; live[nlive++].guest=nullptr; }
+  }
+  // Uses the cached translation for pc if the guest bytes it was built from are unchanged.
+  bool adopt(Chip8VM& vm,u16 pc){
+    if(!cached[pc]) return false;
+    const CacheRegion& c=record(cached[pc]-1); const u8* g=guest()+c.guestOff;
+    for(int b=0;b<c.nblocks;g+=2*c.count[b],++b) if(std::memcmp(&vm.st.mem[c.start[b]],g,2*c.count[b])) return false;
+    Region r; r.pc=pc; r.nblocks=c.nblocks; r.start=c.start; r.count=c.count; r.size=c.codeSize; r.code=code()+c.codeOff;
+    if(!imageExec){ std::memcpy(arena+used,r.code,r.size); r.code=arena+used; used=(used+r.size+15)&~size_t(15); }
+    install(r); ++adopted; return true;
+  }
+  // Names the running binary by its GNU build-id note, a hash the linker takes over the binary's contents, so identical
+  // builds share entries and any other build is rejected. Without the note the executable file itself is hashed; if
+  // even that fails the id is unique to the process and nothing is shared.
+  static u64 buildId(){
+    static const u64 id=[]{
+      u64 h=0;
+      dl_iterate_phdr([](dl_phdr_info* info,size_t,void* out)->int{
+        for(int i=0;i<info->dlpi_phnum;++i){
+          const ElfW(Phdr)& ph=info->dlpi_phdr[i]; if(ph.p_type!=PT_NOTE) continue;
+          const u8* p=reinterpret_cast<const u8*>(info->dlpi_addr+ph.p_vaddr); const u8* end=p+ph.p_memsz;
+          while(p+sizeof(ElfW(Nhdr))<=end){
+            const auto* n=reinterpret_cast<const ElfW(Nhdr)*>(p); const u8* name=p+sizeof *n, *desc=name+((n->n_namesz+3)&~3u);
+            if(n->n_type==NT_GNU_BUILD_ID && n->n_namesz==4 && !std::memcmp(name,"GNU",4)){ *static_cast<u64*>(out)=fnv1a(desc,n->n_descsz); return 1; }
+            p=desc+((n->n_descsz+3)&~3u);
+          }
+        }
+        return 1;  // the executable comes first; shared libraries do not name this build
+      },&h);
+      if(!h){
+        std::ifstream f("/proc/self/exe",std::ios::binary); std::vector<char> b((std::istreambuf_iterator<char>(f)),std::istreambuf_iterator<char>());
+        h=b.empty()?u64(reinterpret_cast<uintptr_t>(&h))^u64(std::chrono::steady_clock::now().time_since_epoch().count()):fnv1a(reinterpret_cast<const u8*>(b.data()),b.size());
+      }
+      return h;
+    }();
+    return id;
+  }
+  static u32 layout(){
+    const i32 o[]={offV,offI,offPC,offDT,offST,offLeft,offSt,offHelpers,offSeen,kHelperCount,i32(sizeof(Chip8VM::State))};
+    return u32(fnv1a(reinterpret_cast<const u8*>(o),sizeof o));
+  }
+  bool validCache(u64 rom)const{
+    const CacheHeader& h=header(); size_t n=imageSize;
+    if(std::memcmp(h.magic,kMagic,sizeof kMagic) || h.version!=kCacheVersion || h.quirks!=kQuirks || h.layout!=layout() || h.rom!=rom) return false;
+    if(h.nRegions>u32(kMaxRegions)) return false;
+    size_t recEnd=sizeof h+size_t(h.nRegions)*sizeof(CacheRegion);
+    if(recEnd>n || h.codeOff>n || h.codeOff%4096 || h.guestBytes>h.codeOff || recEnd>h.codeOff-h.guestBytes || h.codeBytes>n-h.codeOff) return false;
+    for(u32 i=0;i<h.nRegions;++i){
+      const CacheRegion& c=record(i); size_t gl=0;
+      if(c.pc+6>chip8c::kMemSize || c.nblocks==0 || c.nblocks>kMaxBlocks || c.codeSize>kMaxRegionCode || c.codeOff>h.codeBytes || c.codeSize>h.codeBytes-c.codeOff) return false;
+      for(int b=0;b<c.nblocks;++b){ if(c.start[b]+2*c.count[b]>chip8c::kMemSize) return false; gl+=2*c.count[b]; }
+      if(c.guestOff>h.guestBytes || gl>h.guestBytes-c.guestOff) return false;
+    }
+    if(h.build!=buildId()) return false;
+    CacheHeader z=h; z.sum=0;
+    u64 sum=fnv1a(reinterpret_cast<const u8*>(&z),sizeof z); sum=fnv1a(image+sizeof h,recEnd-sizeof h+h.guestBytes,sum);
+    return fnv1a(code(),h.codeBytes,sum)==h.sum;
+  }
+  const CacheHeader& header()const{ return *reinterpret_cast<const CacheHeader*>(image); }
+  const CacheRegion& record(u32 i)const{ return reinterpret_cast<const CacheRegion*>(image+sizeof(CacheHeader))[i]; }
+  const u8* guest()const{ return image+sizeof(CacheHeader)+size_t(header().nRegions)*sizeof(CacheRegion); }
+  const u8* code()const{ return image+header().codeOff; }
+
+  void loadV(Asm& as,int dst,int r){ if(host[r]>=0) as.movRR(dst,host[r]); else as.movzxB(dst,R15,offV+r); }
+  void storeV(Asm& as,int r,int src){ if(host[r]>=0) as.movRR(host[r],src); else as.storeB(src,R15,offV+r); }
+  void loadI(Asm& as,int dst){ if(host[kRegI]>=0) as.movRR(dst,host[kRegI]); else as.movzxW(dst,R15,offI); }
+  void storeI(Asm& as,int src){ if(host[kRegI]>=0) as.movRR(host[kRegI],src); else as.storeW(src,R15,offI); }
+  void writeback(Asm& as){
+    for(int r=0;r<chip8c::kRegCount;++r) if(dirtySet>>r&1) as.storeB(host[r],R15,offV+r);
+    if(dirtySet>>kRegI&1) as.storeW(host[kRegI],R15,offI);
+  }
+  void reload(Asm& as,u32 mask){
+    for(int r=0;r<chip8c::kRegCount;++r) if(mask>>r&1) as.movzxB(host[r],R15,offV+r);
+    if(mask>>kRegI&1) as.movzxW(host[kRegI],R15,offI);
+  }
+  void callOut(Asm& as,int id,u32 op,u16 addr){ as.movRR64(RDI,R14); as.movImm(RSI,op); as.movImm(RDX,addr); as.callMem(R14,offHelpers+id*8); }
+  // Spill, call, then reload what the helper may have changed plus everything living in caller-saved registers.
+  void helper(Asm& as,int id,u32 op,u16 addr,u32 clobbers){
+    writeback(as); callOut(as,id,op,addr);
+    u32 mask=0; for(int r=0;r<kGuestRegs;++r) if((pinned>>r&1) && (!calleeSaved(host[r]) || (clobbers>>r&1))) mask|=1u<<r;
+    reload(as,mask);
+  }
+
+  static Chip8VM::State& S(Ctx* c){ return *c->st; }
+  static u32 cls(Ctx* c,u32,u32){ c->vm->fb.clear(); c->draw=1; return 0; }
+  // Helpers that touch memory set pc past their instruction, as the interpreters do, for watchpoint reports.
+  static u32 draw(Ctx* c,u32 op,u32 addr){ S(c).pc=u16(addr+2); c->vm->sprite((op>>8)&0xF,(op>>4)&0xF,op&0xF); c->draw=1; return 0; }
+  static u32 blit(Ctx* c,u32 op,u32 addr){ S(c).pc=u16(addr+2); c->vm->sprite((op>>8)&0xF,(op>>4)&0xF,op&0xF,false); c->draw=1; return 0; }
+  static u32 rnd(Ctx* c,u32 op,u32){ S(c).v[(op>>8)&0xF]=u8(c->vm->random()&op); return 0; }
+  static u32 key(Ctx* c,u32 x,u32){ return c->keys->down(S(c).v[x]); }
+  static u32 wait(Ctx* c,u32 x,u32){ c->vm->waitKey=true; c->vm->waitReg=u8(x); return c->vm->blockOnWait; }
+  static u32 bcd(Ctx* c,u32 x,u32 addr){ Jit& j=*c->vm->jit; j.dirty=false; S(c).pc=u16(addr+2); c->vm->bcd(u8(x)); return j.dirty; }
+  static u32 store(Ctx* c,u32 x,u32 addr){ Jit& j=*c->vm->jit; j.dirty=false; S(c).pc=u16(addr+2); c->vm->storeRegs(u8(x)); return j.dirty; }
+  static u32 load(Ctx* c,u32 x,u32 addr){ S(c).pc=u16(addr+2); c->vm->loadRegs(u8(x)); return 0; }
+  static u32 call(Ctx* c,u32 nnn,u32 addr){
+    auto& s=S(c); s.pc=u16(addr+2); if(s.sp<chip8c::kStackDepth){ s.stack[s.sp++]=s.pc; s.pc=u16(nnn&0x0FFF); } return 0;
+  }
+  static u32 ret(Ctx* c,u32,u32 addr){ auto& s=S(c); s.pc=u16(addr+2); if(s.sp) s.pc=s.stack[--s.sp]; return 0; }
+  static u32 jpv0(Ctx* c,u32 nnn,u32){ S(c).pc=u16(nnn+S(c).v[0]); return 0; }
+
+  u8* arena=nullptr; size_t used=0; bool pendingReset=false;
+  std::array<Fn,chip8c::kMemSize> entry{}; std::bitset<chip8c::kMemSize> covered, rejected;
+  std::array<Region,kMaxRegions> live{}; int nlive=0;
+  u8* image=nullptr; size_t imageSize=0; bool imageExec=false; std::array<u16,chip8c::kMemSize> cached{};
+  std::array<int,kGuestRegs> host{}; u32 pinned=0, dirtySet=0;
+};
+
+inline bool Chip8VM::ensureJit(){
+  if(!jit){ jit=std::make_unique<Jit>(); if(!jit->ok()){ jit.reset(); return false; } }
+  return true;
+}
+inline Jit* Chip8VM::jitReady(Keypad& k){
+  if(!ensureJit()) return nullptr;
+  jit->ctx.st=&st; jit->ctx.vm=this; jit->ctx.keys=&k; jit->ctx.draw=0; return jit.get();
+}
+inline bool Chip8VM::runJit(Keypad& k,int cycles){
+  if(!jitReady(k)){ engine=Engine::Fast; return runFast(k,cycles); }
+  Jit& j=*jit; bool draw=false; int left=cycles;
+  while(left>0 && !blocked() && !halted){
+    Jit::Fn fn=st.pc<chip8c::kMemSize?j.lookup(*this,st.pc):nullptr;
+    if(fn){
+      j.ctx.left=left; j.running=true; fn(&j.ctx); j.running=false; j.reclaim(); ++stats.dispatches;
+      int done=left-j.ctx.left; stats.instructions+=u64(done); left=j.ctx.left;
+      if(done>0) continue;
+    }
+    draw|=runFast(k,fn?left:1); left-=fn?left:1;
+  }
+  return draw||j.ctx.draw;
+}
+inline void Chip8VM::jitCodeWritten(u16 addr,int len){ if(jit) jit->codeWritten(addr,len); }
+inline void Chip8VM::jitFlush(){ if(jit) jit->flush(); }
+inline void Chip8VM::jitCoverage(){
+  if(!jit) return;
+  for(size_t w=0;w<jit->ctx.seen.size();++w) for(u64 m=std::exchange(jit->ctx.seen[w],0);m;m&=m-1) coverage->set(w*64+size_t(std::countr_zero(m)));
+}
+inline bool Chip8VM::openTranslationCache(const std::string& dir){
+  if(!ensureJit()) return false;
+  char name[64]; std::snprintf(name,sizeof name,"/%016llx-v%u-q%u.jit",(unsigned long long)romHash,Jit::kCacheVersion,Jit::kQuirks);
+  cachePath=dir+name;
+  if(!jit->openCache(cachePath,romHash)) return false;
+  heat=*jit->cachedHeat(); warmBreakpoints(); return true;
+}
+inline bool Chip8VM::saveTranslationCache(){ return jit && !cachePath.empty() && jit->saveCache(cachePath,romHash,*this); }
+#else
+class Jit {};
+inline Jit* Chip8VM::jitReady(Keypad&){ return nullptr; }
+inline bool Chip8VM::ensureJit(){ return false; }
+inline bool Chip8VM::openTranslationCache(const std::string&){ return false; }
+inline bool Chip8VM::saveTranslationCache(){ return false; }
+inline bool Chip8VM::runJit(Keypad& k,int cycles){ engine=Engine::Fast; return runFast(k,cycles); }
+inline void Chip8VM::jitCodeWritten(u16,int){}
+inline void Chip8VM::jitFlush(){}
+inline void Chip8VM::jitCoverage(){}
+#endif
+inline bool Chip8VM::runTiered(Keypad& k,int cycles){
+  using Clock=std::chrono::steady_clock; constexpr int kWarmSlice=32;
+  bool draw=false; int left=cycles, tier=-1; Clock::time_point since{};
+  auto enter=[&](int t){
+    if(t==tier) return;
+    Clock::time_point now=Clock::now(); if(tier>=0) stats.tierNanos[tier]+=u64(std::chrono::duration_cast<std::chrono::nanoseconds>(now-since).count());
+    since=now; tier=t;
+  };
+#ifdef CHIP8_HAVE_JIT
+  Jit* j=jitReady(k);
+#endif
+  while(left>0 && !blocked() && !halted){
+    u16& h=heat[st.pc&chip8c::kAddrMask]; if(h<0xFFFF) ++h;
+#ifdef CHIP8_HAVE_JIT
+    if(h>=hotAt && j && st.pc<chip8c::kMemSize){
+      if(Jit::Fn fn=j->lookup(*this,st.pc)){
+        enter(kHot); j->ctx.left=left; j->running=true; fn(&j->ctx); j->running=false; j->reclaim(); ++stats.dispatches;
+        int done=left-j->ctx.left; left=j->ctx.left; stats.instructions+=u64(done); stats.tierInstructions[kHot]+=u64(done);
+        if(done>0) continue;
+      }
+    }
+#endif
+    if(h>=warmAt){
+      enter(kWarm); u64 before=stats.instructions; draw|=runFast(k,std::min(left,kWarmSlice));
+      u64 n=stats.instructions-before; left-=int(n); stats.tierInstructions[kWarm]+=n;
+    }
+    else { enter(kCold); if(coverage) coverage->set(st.pc&chip8c::kAddrMask); draw|=step(k); --left; ++stats.instructions; ++stats.dispatches; ++stats.tierInstructions[kCold]; }
+  }
+  enter(-1);
+#ifdef CHIP8_HAVE_JIT
+  if(j) draw|=j->ctx.draw!=0;
+#endif
+  return draw;
+}
+inline Chip8VM::~Chip8VM()=default;
+
+// Toggles a random key about every 30 frames: the stand-in player for batch jobs.
+inline void randomKeys(Rng& r,Keypad& keys,Chip8VM& vm){
+  if(r.below(30)) return;
+  u8 k=u8(r.below(chip8c::kKeyCount)); bool down=!keys.down(k); keys.set(k,down); if(down) vm.feedKey(k);
+}
+
+// Watch/reward expressions over VM state, e.g. "prev(mem[0x3F0]) < mem[0x3F0]" or "v5 == 0 && dt == 0".
+// Operands: decimal or 0x numbers, v0..vF, I, pc, sp, dt, st, mem[e], and prev(e) (e's value at the previous
+// evaluation, 0 at first). Operators, loosest first: || && == != < <= > >= | ^ & + - then * and unary ! - ~.
+// Source compiles to stack bytecode with constants folded, constant mem[] addresses and constant right operands
+// folded into the instruction; eval() runs one op at a time across a batch of instances so each op is a flat loop.
+class Watch {
+ public:
+  static constexpr int kLanes=64, kMaxDepth=16;
+  using State=Chip8VM::State;
+  bool compile(std::string_view text){
+    src=text; at=0; code.clear(); latch.clear(); slots=0; inPrev=false; ok=true;
+    std::vector<Ins> out; expr(out,0); skip();
+    if(ok && at<src.size()) fail("unexpected input");
+    if(ok){ code=std::move(out); if(depth(code)>kMaxDepth || depth(latch)>kMaxDepth) fail("expression too deep"); }
+    if(!ok){ code.clear(); latch.clear(); }
+    return ok;
+  }
+  int slotCount()const{ return slots; }
+  size_t size()const{ return code.size()+latch.size(); }
+  // out[i] = value for st[i]; slot[i*slotCount()...] is instance i's prev() storage, updated after the result.
+  void eval(const State* const* st,size_t n,i32* out,i32* slot)const{
+    for(size_t base=0;base<n;base+=kLanes){
+      size_t m=std::min<size_t>(kLanes,n-base); Stack s;
+      int sp=run(code,st+base,m,slot+base*size_t(slots),s);
+      if(sp) std::memcpy(out+base,s[0].data(),m*sizeof(i32));
+      run(latch,st+base,m,slot+base*size_t(slots),s);
+    }
+  }
+  i32 eval(const State& st,i32* slot)const{ const State* p=&st; i32 r=0; eval(&p,1,&r,slot); return r; }
+  std::string disasm()const{
+    std::string s; auto list=[&](const std::vector<Ins>& c){ for(const auto& i:c){ s+=kOpNames[i.op]; if(i.imm||i.op==kConst||i.op==kMem||i.op==kReg||i.op==kPrev||i.op==kStore){ s+=' '; s+=std::to_string(i.k); } s+=i.imm?"# ":" "; } };
+    list(code); if(!latch.empty()){ s+="| "; list(latch); } return s;
+  }
+ private:
+  enum Op:u8{ kConst, kReg, kI, kPc, kSp, kDt, kSt, kMem, kMemAt, kPrev, kStore, kNeg, kNot, kCompl,
+              kOr, kAnd, kEq, kNe, kLt, kLe, kGt, kGe, kBitOr, kBitXor, kBitAnd, kAdd, kSub, kMul, kOpCount };
+  static constexpr const char* kOpNames[kOpCount]={"const","reg","I","pc","sp","dt","st","mem","mem@","prev","store","neg","not","compl",
+                                                    "or","and","eq","ne","lt","le","gt","ge","bor","bxor","band","add","sub","mul"};
+  struct Ins{ Op op; bool imm=false; i32 k=0; };
+  using Stack=std::array<std::array<i32,kLanes>,kMaxDepth>;
+  static i32 apply(Op op,i32 a,i32 b){
+    switch(op){
+      case kOr: return a||b; case kAnd: return a&&b; case kEq: return a==b; case kNe: return a!=b; case kLt: return a<b; case kLe: return a<=b;
+      case kGt: return a>b; case kGe: return a>=b; case kBitOr: return a|b; case kBitXor: return a^b; case kBitAnd: return a&b;
+      case kAdd: return i32(u32(a)+u32(b)); case kSub: return i32(u32(a)-u32(b)); case kMul: return i32(u32(a)*u32(b)); default: return 0;
+    }
+  }
+  static i32 unary(Op op,i32 a){ return op==kNeg?i32(0u-u32(a)):op==kNot?!a:~a; }
+  template <typename F> static void lanes(i32* d,size_t m,F f){ for(size_t l=0;l<m;++l) d[l]=f(l); }
+  template <Op O> static void binary(i32* a,const i32* b,i32 k,bool imm,size_t m){
+    if(imm) for(size_t l=0;l<m;++l) a[l]=apply(O,a[l],k);
+    else for(size_t l=0;l<m;++l) a[l]=apply(O,a[l],b[l]);
+  }
+  using Binary=void(*)(i32*,const i32*,i32,bool,size_t);
+  static constexpr Binary kBinary[kOpCount]={nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,
+    binary<kOr>,binary<kAnd>,binary<kEq>,binary<kNe>,binary<kLt>,binary<kLe>,binary<kGt>,binary<kGe>,binary<kBitOr>,binary<kBitXor>,binary<kBitAnd>,binary<kAdd>,binary<kSub>,binary<kMul>};
+  int run(const std::vector<Ins>& c,const State* const* st,size_t m,i32* slot,Stack& s)const{
+    int sp=0;
+    for(const auto& in:c){
+      i32* t=sp<kMaxDepth?s[size_t(sp)].data():nullptr; i32* u=sp?s[size_t(sp-1)].data():nullptr; const i32 k=in.k;  // t: push ops only
+      switch(in.op){
+        case kConst: lanes(t,m,[&](size_t){ return k; }); ++sp; break;
+        case kReg: lanes(t,m,[&](size_t l){ return i32(st[l]->v[size_t(k)]); }); ++sp; break;
+        case kI: lanes(t,m,[&](size_t l){ return i32(st[l]->I); }); ++sp; break;
+        case kPc: lanes(t,m,[&](size_t l){ return i32(st[l]->pc); }); ++sp; break;
+        case kSp: lanes(t,m,[&](size_t l){ return i32(st[l]->sp); }); ++sp; break;
+        case kDt: lanes(t,m,[&](size_t l){ return i32(st[l]->DT); }); ++sp; break;
+        case kSt: lanes(t,m,[&](size_t l){ return i32(st[l]->ST); }); ++sp; break;
+        case kMem: lanes(t,m,[&](size_t l){ return i32(st[l]->mem[size_t(k)]); }); ++sp; break;
+        case kPrev: lanes(t,m,[&](size_t l){ return slot[l*size_t(slots)+size_t(k)]; }); ++sp; break;
+        case kMemAt: lanes(u,m,[&](size_t l){ return i32(st[l]->mem[size_t(u[l])&chip8c::kAddrMask]); }); break;
+        case kStore: for(size_t l=0;l<m;++l) slot[l*size_t(slots)+size_t(k)]=u[l]; --sp; break;
+        case kNeg: case kNot: case kCompl: lanes(u,m,[&](size_t l){ return unary(in.op,u[l]); }); break;
+        default: if(in.imm) kBinary[in.op](u,nullptr,k,true,m); else { kBinary[in.op](s[size_t(sp-2)].data(),u,k,false,m); --sp; } break;
+      }
+    }
+    return sp;
+  }
+  static int depth(const std::vector<Ins>& c){
+    int d=0, hi=0;
+    for(const auto& i:c){
+      if(i.op<=kMem||i.op==kPrev) ++d; else if(i.op==kStore) --d; else if(i.op>=kOr && !i.imm) --d;
+      hi=std::max(hi,d);
+    }
+    return hi;
+  }
+  // Precedence climbing; level 0 is ||, deeper levels bind tighter.
+  static constexpr int kLevels=9;
+  static int level(Op op){
+    switch(op){
+      case kOr: return 0; case kAnd: return 1; case kEq: case kNe: return 2; case kLt: case kLe: case kGt: case kGe: return 3;
+      case kBitOr: return 4; case kBitXor: return 5; case kBitAnd: return 6; case kMul: return 8; default: return 7;
+    }
+  }
+  std::optional<Op> binop(){
+    skip();
+    static constexpr std::pair<std::string_view,Op> kTokens[]={{"||",kOr},{"&&",kAnd},{"==",kEq},{"!=",kNe},{"<=",kLe},{">=",kGe},{"<",kLt},{">",kGt},
+                                                              {"|",kBitOr},{"^",kBitXor},{"&",kBitAnd},{"+",kAdd},{"-",kSub},{"*",kMul}};
+    for(const auto& [t,op]:kTokens) if(src.substr(at,t.size())==t) return op;
+    return std::nullopt;
+  }
+  void expr(std::vector<Ins>& out,int minLevel){
+    if(minLevel>=kLevels){ operand(out); return; }
+    expr(out,minLevel+1);
+    for(auto op=binop(); ok && op && level(*op)==minLevel; op=binop()){
+      at+=op==kOr||op==kAnd||op==kEq||op==kNe||op==kLe||op==kGe?2:1;
+      std::vector<Ins> rhs; expr(rhs,minLevel+1);
+      emit(out,rhs,*op);
+    }
+  }
+  // Folds constant operands: both constant becomes a constant, a constant right operand becomes an immediate.
+  static void emit(std::vector<Ins>& out,std::vector<Ins>& rhs,Op op){
+    bool rc=rhs.size()==1 && rhs[0].op==kConst;
+    if(rc && !out.empty() && out.back().op==kConst && out.size()==1){ out[0].k=apply(op,out[0].k,rhs[0].k); return; }
+    if(rc){ out.push_back(Ins{op,true,rhs[0].k}); return; }
+    out.insert(out.end(),rhs.begin(),rhs.end()); out.push_back(Ins{op});
+  }
+  void operand(std::vector<Ins>& out){
+    skip(); if(!ok) return;
+    if(at>=src.size()){ fail("expected an operand"); return; }
+    char c=src[at];
+    if(c=='!'||c=='-'||c=='~'){
+      ++at; std::vector<Ins> e; operand(e); Op op=c=='!'?kNot:c=='-'?kNeg:kCompl;
+      if(e.size()==1 && e[0].op==kConst) e[0].k=unary(op,e[0].k); else e.push_back(Ins{op});
+      out.insert(out.end(),e.begin(),e.end()); return;
+    }
+    if(c=='('){ ++at; expr(out,0); expect(')'); return; }
+    if(std::isdigit(u8(c))){
+      size_t end=at; unsigned long v=0; bool hex=src.substr(at,2)=="0x"||src.substr(at,2)=="0X"; if(hex) end+=2;
+      size_t digits=end; while(end<src.size() && (hex?std::isxdigit(u8(src[end])):std::isdigit(u8(src[end])))) ++end;
+      if(end==digits){ fail("bad number"); return; }
+      v=std::strtoul(std::string(src.substr(digits,end-digits)).c_str(),nullptr,hex?16:10);
+      if(v>0xFFFFFFu){ fail("number too large"); return; }
+      at=end; out.push_back(Ins{kConst,false,i32(v)}); return;
+    }
+    size_t end=at; while(end<src.size() && std::isalnum(u8(src[end]))) ++end;
+    std::string_view w=src.substr(at,end-at); at=end;
+    if(w.size()==2 && (w[0]=='v'||w[0]=='V') && std::isxdigit(u8(w[1]))){ out.push_back(Ins{kReg,false,i32(std::strtoul(std::string(w.substr(1)).c_str(),nullptr,16))}); return; }
+    static constexpr std::pair<std::string_view,Op> kFields[]={{"I",kI},{"pc",kPc},{"PC",kPc},{"sp",kSp},{"SP",kSp},{"dt",kDt},{"DT",kDt},{"st",kSt},{"ST",kSt}};
+    for(const auto& [name,op]:kFields) if(w==name){ out.push_back(Ins{op}); return; }
+    if(w=="mem"){
+      expect('['); std::vector<Ins> a; expr(a,0); expect(']');
+      if(a.size()==1 && a[0].op==kConst) out.push_back(Ins{kMem,false,a[0].k&chip8c::kAddrMask});
+      else { out.insert(out.end(),a.begin(),a.end()); out.push_back(Ins{kMemAt}); }
+      return;
+    }
+    if(w=="prev"){
+      if(inPrev){ fail("prev() cannot nest"); return; }
+      expect('('); inPrev=true; std::vector<Ins> e; expr(e,0); inPrev=false; expect(')');
+      if(!ok) return;
+      latch.insert(latch.end(),e.begin(),e.end()); latch.push_back(Ins{kStore,false,slots});
+      out.push_back(Ins{kPrev,false,slots++}); return;
+    }
+    fail(w.empty()?"unexpected character":"unknown name");
+  }
+  void skip(){ while(at<src.size() && std::isspace(u8(src[at]))) ++at; }
+  void expect(char c){ skip(); if(ok && (at>=src.size()||src[at]!=c)){ fail(std::string("expected '")+c+"'"); return; } ++at; }
+  void fail(const std::string& m){ if(ok) std::cerr<<"watch: "<<m<<" at column "<<at+1<<": "<<src<<"\n"; ok=false; }
+  std::string_view src; size_t at=0; bool ok=true, inPrev=false; int slots=0;
+  std::vector<Ins> code, latch;
+};
+
+// Runs `instances` seeded VMs with random input and evaluates a watch expression on all of them every frame.
+class WatchRun {
+ public:
+  struct Opt{ std::string rom, expr; int frames=3600, instances=64, cycles=10; u64 seed=1; };
+  explicit WatchRun(const Opt& o):opt(o){}
+  bool run(){
+    if(!w.compile(opt.expr)) return false;
+    std::cout<<"watch: "<<w.disasm()<<"\n";
+    Chip8VM image; if(!image.load(opt.rom)) return false;
+    size_t n=size_t(opt.instances);
+    std::vector<std::unique_ptr<Chip8VM>> vms; std::vector<Keypad> keys(n); std::vector<Rng> input;
+    for(size_t i=0;i<n;++i){
+      auto vm=std::make_unique<Chip8VM>(); vm->cloneFrom(image); vm->setEngine(Chip8VM::Engine::Fast); vm->setBeep(false); vm->seed(Rng::jobSeed(opt.seed,i));
+      vms.push_back(std::move(vm)); input.emplace_back(Rng::jobSeed(opt.seed^0x4B455953ull,i));
+    }
+    std::vector<const Chip8VM::State*> st(n); for(size_t i=0;i<n;++i) st[i]=&vms[i]->state();
+    std::vector<i32> out(n), slots(n*size_t(w.slotCount())); std::vector<u64> hits(n); u64 total=0; double ns=0; long firstFrame=-1; size_t firstVm=0;
+    for(int f=0;f<opt.frames;++f){
+      for(size_t i=0;i<n;++i){ randomKeys(input[i],keys[i],*vms[i]); vms[i]->frame(keys[i],opt.cycles); }
+      auto t0=std::chrono::steady_clock::now();
+      w.eval(st.data(),n,out.data(),slots.data());
+      ns+=std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now()-t0).count();
+      for(size_t i=0;i<n;++i) if(out[i]){ ++hits[i]; ++total; if(firstFrame<0){ firstFrame=f; firstVm=i; } }
+    }
+    size_t any=size_t(std::count_if(hits.begin(),hits.end(),[](u64 h){ return h>0; }));
+    std::cout<<"watch: "<<n<<" instances x "<<opt.frames<<" frames, true "<<total<<" times on "<<any<<" instances";
+    if(firstFrame>=0) std::cout<<", first at instance "<<firstVm<<" frame "<<firstFrame;
+    std::cout<<"; "<<ns/(double(n)*opt.frames)<<" ns per instance-frame\n";
+    return true;
+  }
+ private: Opt opt; Watch w;
+};
+
+// Observations for batched RL environments. Each push pools the last two frames (pixel max, which undoes XOR
+// flicker), crops and downsamples in the same pass over the FB bytes, then stacks the last `stack` results oldest
+// first into the caller's tensor as [stack][h][w] bytes of 0 or 255. Rows are combined eight pixels per u64.
+class Observer {
+ public:
+  struct Opt{ int stack=4, downsample=1, x=0, y=0, w=chip8c::kDisplayWidth, h=chip8c::kDisplayHeight; bool maxPool=true; };
+  bool configure(const Opt& o,size_t envs){
+    const int d=o.downsample;
+    if(o.stack<1||o.stack>16||(d!=1&&d!=2&&d!=4&&d!=8)||o.x<0||o.y<0||o.w<=0||o.h<=0||o.x+o.w>chip8c::kDisplayWidth||o.y+o.h>chip8c::kDisplayHeight||o.w%d||o.h%d){
+      std::cerr<<"observer: bad crop/downsample/stack\n"; return false;
+    }
+    opt=o; ow=o.w/d; oh=o.h/d; plane=size_t(ow*oh);
+    ring.assign(envs*size_t(o.stack)*plane,0); heads.assign(envs,0); return true;
+  }
+  size_t frameBytes()const{ return plane; }
+  size_t bytes()const{ return plane*size_t(opt.stack); }
+  int width()const{ return ow; }
+  int height()const{ return oh; }
+  void clear(size_t env){ std::memset(&ring[env*size_t(opt.stack)*plane],0,size_t(opt.stack)*plane); heads[env]=0; }
+  void push(size_t env,const Chip8VM::FB& prev,const Chip8VM::FB& cur,u8* out){
+    u8* base=&ring[env*size_t(opt.stack)*plane]; int& h=heads[env];
+    pool(prev,cur,base+size_t(h)*plane); h=(h+1)%opt.stack;
+    for(int j=0;j<opt.stack;++j) std::memcpy(out+size_t(j)*plane,base+size_t((h+j)%opt.stack)*plane,plane);
+  }
+ private:
+  static u64 word(const u8* p){ u64 w; std::memcpy(&w,p,8); return w; }
+  void pool(const Chip8VM::FB& prev,const Chip8VM::FB& cur,u8* o)const{
+    const int d=opt.downsample, w=opt.w; const u8* pa=cur.pix.data(); const u8* pb=opt.maxPool?prev.pix.data():pa;
+    std::array<u8,chip8c::kDisplayWidth> row;
+    for(int oy=0;oy<oh;++oy,o+=ow){
+      const size_t top=size_t((opt.y+oy*d)*chip8c::kDisplayWidth+opt.x);
+      int x=0;
+      for(;x+8<=w;x+=8){
+        u64 acc=0; for(int r=0;r<d;++r){ size_t at=top+size_t(r*chip8c::kDisplayWidth+x); acc|=word(pa+at)|word(pb+at); }
+        std::memcpy(&row[size_t(x)],&acc,8);
+      }
+      for(;x<w;++x){ u8 v=0; for(int r=0;r<d;++r){ size_t at=top+size_t(r*chip8c::kDisplayWidth+x); v|=pa[at]|pb[at]; } row[size_t(x)]=v; }
+      if(d==1){
+        // Bytes are 0 or 1, so multiplying a word by 0xFF maps each to 0 or 255 without carries.
+        int i=0; for(;i+8<=ow;i+=8){ u64 v=word(&row[size_t(i)])*0xFFull; std::memcpy(o+i,&v,8); }
+        for(;i<ow;++i) o[i]=u8(row[size_t(i)]*0xFF);
+      } else for(int i=0;i<ow;++i){ u8 v=0; for(int k=0;k<d;++k) v|=row[size_t(i*d+k)]; o[i]=u8(v*0xFF); }
+    }
+  }
+  Opt opt; int ow=0, oh=0; size_t plane=0; std::vector<u8> ring; std::vector<int> heads;
+};
+
+// A batch of environments over one ROM for RL. Actions are keys 0-15, or kNoKey, held for `skip` frames; the
+// observation pools the last two of those frames. Rewards and episode ends are Watch expressions evaluated across
+// the batch once per step; finished episodes restart at once and report their first observation.
+class EnvBatch {
+ public:
+  static constexpr u8 kNoKey=chip8c::kKeyCount;
+  struct Opt{ std::string rom, reward="0", done="0"; int envs=16, skip=4, cycles=10, maxSteps=10000; u64 seed=1; Observer::Opt obs; };
+  bool init(const Opt& o){
+    opt=o; if(!image.load(opt.rom) || !reward.compile(opt.reward) || !ends.compile(opt.done)) return false;
+    size_t n=size_t(opt.envs); if(!observer.configure(opt.obs,n)) return false;
+    envs.clear(); states.clear();
+    for(size_t i=0;i<n;++i){ envs.push_back(std::make_unique<Env>()); states.push_back(&envs.back()->vm.state()); }
+    rewardSlots.assign(n*size_t(reward.slotCount()),0); doneSlots.assign(n*size_t(ends.slotCount()),0);
+    values.assign(n,0); finished.assign(n,0); return true;
+  }
+  size_t size()const{ return envs.size(); }
+  size_t observationBytes()const{ return observer.bytes(); }
+  const Observer& observation()const{ return observer; }
+  u64 episodes()const{ return episodeCount; }
+  void reset(u8* obs){ for(size_t i=0;i<envs.size();++i) restart(i,obs+i*observer.bytes()); }
+  // obs is [envs][stack][h][w]; reward and done hold one entry per env.
+  void step(const u8* actions,u8* obs,float* rewardOut,u8* doneOut){
+    const size_t n=envs.size(), bytes=observer.bytes();
+    for(size_t i=0;i<n;++i){
+      Env& e=*envs[i]; e.keys.reset();
+      if(actions[i]<kNoKey){ e.keys.set(actions[i],true); e.vm.feedKey(actions[i]); }
+      for(int f=0;f<opt.skip;++f){ if(f==opt.skip-1) e.prev=e.vm.framebuffer(); e.vm.frame(e.keys,opt.cycles); }
+      ++e.steps;
+    }
+    reward.eval(states.data(),n,values.data(),rewardSlots.data());
+    ends.eval(states.data(),n,finished.data(),doneSlots.data());
+    for(size_t i=0;i<n;++i){
+      Env& e=*envs[i]; rewardOut[i]=float(values[i]); doneOut[i]=finished[i]!=0 || e.steps>=opt.maxSteps;
+      if(doneOut[i]) restart(i,obs+i*bytes); else observer.push(i,e.prev,e.vm.framebuffer(),obs+i*bytes);
+    }
+  }
+ private:
+  struct Env{ Chip8VM vm; Keypad keys; Chip8VM::FB prev{}; int steps=0; u64 episode=0; };
+  // New episode: fresh image and seed, empty frame stack, and prev() slots primed on the start state.
+  void restart(size_t i,u8* obs){
+    Env& e=*envs[i]; e.vm.cloneFrom(image); e.vm.setEngine(Chip8VM::Engine::Fast); e.vm.setBeep(false);
+    e.vm.seed(Rng::jobSeed(opt.seed,(u64(i)<<32)|e.episode++)); e.keys.reset(); e.steps=0; ++episodeCount;
+    reward.eval(*states[i],rewardSlots.data()+i*size_t(reward.slotCount())); ends.eval(*states[i],doneSlots.data()+i*size_t(ends.slotCount()));
+    observer.clear(i); observer.push(i,e.vm.framebuffer(),e.vm.framebuffer(),obs);
+  }
+  Opt opt; Chip8VM image; Watch reward, ends; Observer observer; std::vector<std::unique_ptr<Env>> envs; std::vector<const Chip8VM::State*> states;
+  std::vector<i32> rewardSlots, doneSlots, values, finished; u64 episodeCount=0;
+};
+
+// Steps an EnvBatch with random actions and reports throughput, reward and an observation digest.
+class EnvRun {
+ public:
+  struct Opt{ EnvBatch::Opt env; int steps=1000; };
+  explicit EnvRun(const Opt& o):opt(o){}
+  bool run(){
+    if(!batch.init(opt.env)) return false;
+    const size_t n=batch.size(); std::vector<u8> obs(n*batch.observationBytes()), actions(n), done(n); std::vector<float> reward(n);
+    batch.reset(obs.data()); Rng r(opt.env.seed); double total=0; u64 digest=0;
+    auto t0=std::chrono::steady_clock::now();
+    for(int s=0;s<opt.steps;++s){
+      for(auto& a:actions) a=u8(r.below(EnvBatch::kNoKey+1));
+      batch.step(actions.data(),obs.data(),reward.data(),done.data());
+      for(float x:reward) total+=x;
+      digest=fnv1a(obs.data(),obs.size(),digest);
+    }
+    double secs=std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+    const auto& o=batch.observation();
+    std::cout<<"env: "<<n<<" envs x "<<opt.steps<<" steps, obs "<<opt.env.obs.stack<<"x"<<o.height()<<"x"<<o.width()<<", "<<double(n)*opt.steps/secs
+             <<" env-steps/s, reward="<<total<<" episodes="<<batch.episodes()<<" obs_digest="<<std::hex<<digest<<std::dec<<"\n";
+    return true;
+  }
+ private: Opt opt; EnvBatch batch;
+};
+
+// Concurrent counting Bloom filter: kHashes saturating 8-bit counters per key, bumped with relaxed CAS. Memory is
+// fixed however many keys go in; counts can only be over-estimated, so a key reported unseen really is new.
+class CountingBloom {
+ public:
+  static constexpr int kHashes=4;
+  explicit CountingBloom(size_t bytes):counters(std::bit_ceil(std::max<size_t>(bytes,64))),mask(counters.size()-1){}
+  // Counts one visit and returns the estimate from before it.
+  u32 add(u64 key){
+    u32 est=255; u64 h2=Rng(key).next()|1;
+    for(int i=0;i<kHashes;++i){
+      auto& c=counters[size_t(key+u64(i)*h2)&mask]; u8 v=c.load(std::memory_order_relaxed);
+      while(v<255 && !c.compare_exchange_weak(v,u8(v+1),std::memory_order_relaxed)){}
+      est=std::min<u32>(est,v);
+    }
+    return est;
+  }
+  u32 count(u64 key)const{
+    u32 est=255; u64 h2=Rng(key).next()|1;
+    for(int i=0;i<kHashes;++i) est=std::min<u32>(est,counters[size_t(key+u64(i)*h2)&mask].load(std::memory_order_relaxed));
+    return est;
+  }
+  double fill()const{ size_t n=0; for(const auto& c:counters) n+=c.load(std::memory_order_relaxed)!=0; return double(n)/double(counters.size()); }
+  size_t bytes()const{ return counters.size(); }
+ private: std::vector<std::atomic<u8>> counters; size_t mask;
+};
+
+// Bounded archive of restart points, one per cell, split into shards with their own lock. A full shard evicts its
+// most-visited cell. pick() favours cells that were chosen and visited least (best of a few random samples).
+class CellArchive {
+ public:
+  static constexpr int kShards=64, kSamples=4;
+  struct Entry{ u64 key=0; i32 score=0; u32 depth=0; u64 chosen=0; Chip8VM::Snapshot snap; };
+  explicit CellArchive(size_t capacity):perShard(std::max<size_t>(1,capacity/kShards)){ for(auto& s:shards) s.entries.reserve(perShard); }
+  // Stores the state if its cell is new, or replaces the cell's state when it scores higher or equal in fewer frames.
+  bool offer(u64 key,i32 score,u32 depth,const CountingBloom& seen,const Chip8VM& vm){
+    Shard& s=shards[key%kShards]; std::lock_guard lk(s.mu);
+    for(auto& e:s.entries) if(e.key==key){
+      if(score<e.score || (score==e.score && depth>=e.depth)) return false;
+      e.score=score; e.depth=depth; e.snap=vm.snapshot(); return true;
+    }
+    if(s.entries.size()<perShard){ s.entries.push_back(Entry{key,score,depth,0,vm.snapshot()}); ++cells; return true; }
+    Entry* worst=&s.entries[0]; u32 most=seen.count(worst->key);
+    for(auto& e:s.entries){ u32 c=seen.count(e.key); if(c>most){ most=c; worst=&e; } }
+    if(most<=seen.count(key)) return false;
+    *worst=Entry{key,score,depth,0,vm.snapshot()}; ++evictions; return true;
+  }
+  bool pick(Rng& r,const CountingBloom& seen,Entry& out){
+    for(u32 i=0, start=r.below(kShards);i<kShards;++i){
+      Shard& s=shards[(start+i)%kShards]; std::lock_guard lk(s.mu);
+      if(s.entries.empty()) continue;
+      Entry* best=nullptr; double w=-1;
+      for(int i=0;i<kSamples;++i){
+        Entry& e=s.entries[r.below(u32(s.entries.size()))];
+        double x=1/std::sqrt(1.0+double(e.chosen))+1/std::sqrt(1.0+seen.count(e.key));
+        if(x>w){ w=x; best=&e; }
+      }
+      ++best->chosen; out=*best; return true;
+    }
+    return false;
+  }
+  size_t size()const{ return cells; }
+  u64 evicted()const{ return evictions; }
+  i32 bestScore(){ i32 b=INT32_MIN; for(auto& s:shards){ std::lock_guard lk(s.mu); for(auto& e:s.entries) b=std::max(b,e.score); } return b; }
+ private:
+  struct Shard{ std::mutex mu; std::vector<Entry> entries; };
+  size_t perShard; std::array<Shard,kShards> shards; std::atomic<size_t> cells{0}; std::atomic<u64> evictions{0};
+};
+
+// Go-Explore style search: workers repeatedly restore a frontier state from the CellArchive and play random keys
+// for a burst of frames. Each frame maps to a cell (the screen at 4x4-pixel resolution plus a Watch expression,
+// e.g. a level byte); the CountingBloom counts cell visits and only rarely seen cells are offered to the archive.
+class Novelty {
+ public:
+  struct Opt{ std::string rom, cell="0", score="0"; u64 frames=1000000; int threads=0, burst=100, cycles=10; size_t archive=4096, bloomBytes=size_t(1)<<22; u64 seed=1; };
+  static constexpr u32 kOfferBelow=4;
+  explicit Novelty(const Opt& o):opt(o),seen(o.bloomBytes),archive(o.archive){}
+  bool run(){
+    if(!image.load(opt.rom) || !cellExpr.compile(opt.cell) || !scoreExpr.compile(opt.score)) return false;
+    image.setBeep(false);
+    std::vector<i32> slots(size_t(cellExpr.slotCount()+scoreExpr.slotCount()));
+    u64 root=cellKey(image,cellExpr.eval(image.state(),slots.data())); seen.add(root); archive.offer(root,scoreExpr.eval(image.state(),slots.data()+cellExpr.slotCount()),0,seen,image);
+    int n=opt.threads>0?opt.threads:int(std::max(1u,std::thread::hardware_concurrency()));
+    auto t0=std::chrono::steady_clock::now();
+    std::vector<std::thread> pool; for(int t=0;t<n;++t) pool.emplace_back([this,t]{ work(t); });
+    for(auto& t:pool) t.join();
+    double secs=std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+    std::cout<<"novelty: "<<frames<<" frames on "<<n<<" threads in "<<secs<<"s ("<<double(frames)/secs<<" frames/s), restarts="<<restarts
+             <<" restore="<<double(restoreNs)/1e6<<"ms ("<<(restarts?double(restoreNs)/1e3/double(restarts):0.0)<<"us each) new_cells="<<discovered<<" archive="<<archive.size()<<" evicted="<<archive.evicted()<<" best_score="<<archive.bestScore()
+             <<" bloom_fill="<<seen.fill()<<" ("<<seen.bytes()/1024<<" KiB)\n";
+    return true;
+  }
+ private:
+  // Bit per 4x4 block of the screen (128 bits), folded with the cell expression's value.
+  static u64 cellKey(const Chip8VM& vm,i32 extra){
+    const auto& pix=vm.framebuffer().pix; u64 bits[2]{};
+    for(int y=0;y<chip8c::kDisplayHeight;++y) for(int x=0;x<chip8c::kDisplayWidth;x+=8){
+      u64 w; std::memcpy(&w,&pix[size_t(y*chip8c::kDisplayWidth+x)],8);
+      int b=(y/4)*16+x/4; if(w&0xFFFFFFFFull) bits[b>>6]|=1ull<<(b&63); if(w>>32) bits[(b+1)>>6]|=1ull<<((b+1)&63);
+    }
+    return Rng(bits[0]^Rng(bits[1]^Rng(u64(u32(extra))).next()).next()).next();
+  }
+  void work(int t){
+    Chip8VM vm; vm.cloneFrom(image); vm.setEngine(Chip8VM::Engine::Fast); vm.setBeep(false);
+    Keypad keys; Rng r(Rng::jobSeed(opt.seed,u64(t))); CellArchive::Entry from;
+    std::vector<i32> cs(size_t(cellExpr.slotCount())), ss(size_t(scoreExpr.slotCount()));
+    u64 frames=0, found=0, starts=0, restoring=0;
+    while(played.fetch_add(u64(opt.burst))<opt.frames && archive.pick(r,seen,from)){
+      auto r0=std::chrono::steady_clock::now(); vm.restore(from.snap);
+      restoring+=u64(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-r0).count());
+      vm.seed(r.next()); keys.reset(); ++starts;
+      std::fill(cs.begin(),cs.end(),0); std::fill(ss.begin(),ss.end(),0);
+      for(int f=0;f<opt.burst;++f){
+        randomKeys(r,keys,vm); vm.frame(keys,opt.cycles); ++frames;
+        u64 key=cellKey(vm,cellExpr.eval(vm.state(),cs.data())); i32 score=scoreExpr.eval(vm.state(),ss.data());
+        u32 before=seen.add(key); if(!before) ++found;
+        if(before<kOfferBelow) archive.offer(key,score,from.depth+u32(f)+1,seen,vm);
+      }
+    }
+    discovered+=found; restarts+=starts; restoreNs+=restoring; this->frames+=frames;
+  }
+  Opt opt; Chip8VM image; Watch cellExpr, scoreExpr; CountingBloom seen; CellArchive archive;
+  std::atomic<u64> played{0}, frames{0}, discovered{0}, restarts{0}, restoreNs{0};
+};
+
+// HyperLogLog distinct counter: 2^14 one-byte registers (16 KiB, about 0.8% error), mergeable by register max.
+class HyperLogLog {
+ public:
+  static constexpr int kBits=14; static constexpr size_t kRegisters=size_t(1)<<kBits;
+  void add(u64 h){
+    h=Rng(h).next();  // callers pass FNV digests; remix so the top bits are uniform
+    size_t i=size_t(h>>(64-kBits)); u8 rank=u8(std::countl_zero((h<<kBits)|(u64(1)<<(kBits-1)))+1);
+    if(rank>regs[i]) regs[i]=rank;
+  }
+  void merge(const HyperLogLog& o){ for(size_t i=0;i<kRegisters;++i) regs[i]=std::max(regs[i],o.regs[i]); }
+  double estimate()const{
+    double sum=0; size_t zeros=0; for(u8 r:regs){ sum+=std::ldexp(1.0,-int(r)); zeros+=r==0; }
+    const double m=double(kRegisters), e=0.7213/(1+1.079/m)*m*m/sum;
+    return e<=2.5*m && zeros ? m*std::log(m/double(zeros)) : e;  // linear counting while small
+  }
+ private: std::array<u8,kRegisters> regs{};
+};
+
+// Coverage over a batch of seeded VMs with random input: distinct framebuffers and full states (HyperLogLog) and
+// executed instruction addresses (exact bitmap), reported every `every` frames. The run stops early once `patience`
+// reports in a row have added no pc and grown neither count by more than 1%.
+class Coverage {
+ public:
+  struct Opt{ std::string rom; int frames=36000, instances=16, every=600, patience=5, cycles=10; u64 seed=1; Chip8VM::Engine engine=Chip8VM::Engine::Tiered; };
+  explicit Coverage(const Opt& o):opt(o){}
+  bool run(){
+    Chip8VM image; if(!image.load(opt.rom)) return false;
+    size_t n=size_t(opt.instances); std::vector<std::unique_ptr<Chip8VM>> vms; std::vector<Keypad> keys(n); std::vector<Rng> input;
+    for(size_t i=0;i<n;++i){
+      auto vm=std::make_unique<Chip8VM>(); vm->cloneFrom(image); vm->setEngine(opt.engine); vm->setBeep(false); vm->seed(Rng::jobSeed(opt.seed,i)); vm->trackCoverage(&pcs);
+      vms.push_back(std::move(vm)); input.emplace_back(Rng::jobSeed(opt.seed^0x4B455953ull,i));
+    }
+    double lastFb=0, lastState=0; size_t lastPc=0; int flat=0;
+    std::cout<<"frame fb_distinct state_distinct pc_covered\n";
+    for(int f=1;f<=opt.frames;++f){
+      for(size_t i=0;i<n;++i){ randomKeys(input[i],keys[i],*vms[i]); vms[i]->frame(keys[i],opt.cycles); frames.add(vms[i]->fbHash()); states.add(vms[i]->stateHash()); }
+      if(f%opt.every && f!=opt.frames) continue;
+      double fb=frames.estimate(), state=states.estimate(); size_t pc=pcs.count();
+      std::cout<<f<<" "<<u64(fb)<<" "<<u64(state)<<" "<<pc<<"\n";
+      flat=(pc==lastPc && fb<=lastFb*1.01 && state<=lastState*1.01)?flat+1:0;
+      lastFb=fb; lastState=state; lastPc=pc;
+      if(opt.patience>0 && flat>=opt.patience){ std::cout<<"plateau: no growth over the last "<<flat*opt.every<<" frames, stopping at frame "<<f<<"\n"; break; }
+    }
+    std::cout<<"pc coverage ("<<Chip8VM::engineName(vms[0]->activeEngine())<<" engine): "<<pcs.count()<<" addresses";
+    for(int a=0;a<chip8c::kMemSize;){
+      if(!pcs.test(size_t(a))){ ++a; continue; }
+      int b=a; while(b+1<chip8c::kMemSize && (pcs.test(size_t(b+1))||(b+2<chip8c::kMemSize && pcs.test(size_t(b+2))))) ++b;
+      char r[24]; std::snprintf(r,sizeof r," %03X-%03X",a,b); std::cout<<r; a=b+1;
+    }
+    std::cout<<"\n"; return true;
+  }
+ private: Opt opt; HyperLogLog frames, states; std::bitset<chip8c::kMemSize> pcs;
+};
+
+// Runs a ROM with random input under breakpoints "addr" or "addr:condition" (hex address, watch expression) and
+// watchpoints "r:", "w:" or "rw:" plus "addr" or "first-last", printing the machine at each stop and every watched
+// access. A condition is compiled once and evaluated only when its trap is reached.
+class Debugger {
+ public:
+  struct Opt{ std::string rom; std::vector<std::string> breaks; int frames=3600, cycles=10, maxStops=20; u64 seed=1; Chip8VM::Engine engine=Chip8VM::Engine::Tiered; };
+  explicit Debugger(const Opt& o):opt(o){}
+  bool run(){
+    Chip8VM vm; if(!vm.load(opt.rom)) return false;
+    vm.setEngine(opt.engine); vm.setBeep(false); vm.seed(opt.seed);
+    std::vector<u16> addrs; u64 stops=0, accesses=0; int f=0;
+    for(const std::string& b:opt.breaks){
+      size_t colon=b.find(':'); std::string kind=colon==std::string::npos?"":b.substr(0,colon);
+      if(kind=="r" || kind=="w" || kind=="rw"){
+        char* end=nullptr; const char* p=b.c_str()+colon+1; unsigned long lo=std::strtoul(p,&end,16), hi=lo;
+        if(end!=p && *end=='-'){ p=end+1; hi=std::strtoul(p,&end,16); }
+        if(end==p || *end || hi<lo || hi>=chip8c::kMemSize){ std::cerr<<"debug: bad watchpoint "<<b<<"\n"; return false; }
+        vm.watchMemory(u16(lo),int(hi-lo+1),u8((kind!="w"?Chip8VM::kWatchRead:0)|(kind!="r"?Chip8VM::kWatchWrite:0)));
+        continue;
+      }
+      char* end=nullptr; unsigned long a=std::strtoul(b.c_str(),&end,16);
+      if(end==b.c_str() || a>=chip8c::kMemSize || (*end && *end!=':')){ std::cerr<<"debug: bad breakpoint "<<b<<"\n"; return false; }
+      Chip8VM::BreakCondition cond;
+      if(*end==':'){
+        auto c=std::make_shared<Cond>(); if(!c->w.compile(end+1)) return false;
+        c->slots.resize(size_t(c->w.slotCount()));
+        cond=[c](const Chip8VM::State& st){ return c->w.eval(st,c->slots.data())!=0; };
+      }
+      vm.setBreakpoint(u16(a),std::move(cond)); addrs.push_back(u16(a));
+    }
+    vm.onWatch([&](const Chip8VM::WatchHit& h){
+      if(++accesses>u64(opt.maxStops)) return;
+      char b[64]; std::snprintf(b,sizeof b,"%s %03X at pc %03X frame %d: %02X -> %02X",h.kind==Chip8VM::kWatchRead?"read":"write",h.addr,h.pc,f,h.before,h.after);
+      std::cout<<b<<"\n";
+    });
+    Keypad keys; Rng input(opt.seed^0x4B455953ull); auto t0=std::chrono::steady_clock::now();
+    for(;f<opt.frames;++f){
+      randomKeys(input,keys,vm);
+      for(u64 end=vm.statistics().instructions+u64(opt.cycles);;){
+        vm.run(keys,int(end-vm.statistics().instructions));
+        if(!vm.atBreakpoint()) break;
+        if(++stops<=u64(opt.maxStops)) report(vm,f);
+      }
+      vm.timerTick();
+    }
+    double secs=std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+    if(stops>u64(opt.maxStops)) std::cout<<"("<<stops-u64(opt.maxStops)<<" more stops not shown)\n";
+    if(accesses>u64(opt.maxStops)) std::cout<<"("<<accesses-u64(opt.maxStops)<<" more watched accesses not shown)\n";
+    for(u16 a:addrs){ char b[16]; std::snprintf(b,sizeof b,"%03X",a); std::cout<<"breakpoint "<<b<<": "<<vm.breakpointHits(a)<<" hits\n"; }
+    std::cout<<"debug: "<<opt.frames<<" frames, "<<vm.statistics().instructions<<" instructions in "<<secs<<"s\n";
+    return true;
+  }
+ private:
+  struct Cond{ Watch w; std::vector<i32> slots; };
+  static void report(const Chip8VM& vm,int frame){
+    const Chip8VM::State& st=vm.state(); u16 pc=st.pc&chip8c::kAddrMask;
+    char b[64]; std::snprintf(b,sizeof b,"break %03X frame %d: %-14s I=%03X sp=%u",pc,frame,
+                              Chip8VM::disasm(u16(st.mem[pc]<<8|st.mem[(pc+1)&chip8c::kAddrMask])).c_str(),st.I,st.sp);
+    std::cout<<b;
+    for(int r=0;r<chip8c::kRegCount;++r){ std::snprintf(b,sizeof b," V%X=%02X",r,st.v[r]); std::cout<<b; }
+    std::cout<<"\n";
+  }
+  Opt opt;
+};
+
+// Guest call-stack sampler: every `period` instructions the stack of subroutine entries is read off the return
+// addresses in stack[0..sp) (the CALL before each names its callee) and counted. Output is folded-stack text, one
+// "main;sub_2F6;sub_31A count" line per distinct stack, for flame graph tools. A symbol file ("addr name" per line,
+// hex) names entries, and a label between the innermost entry and pc becomes an extra leaf frame.
+class Profiler {
+ public:
+  struct Opt{ std::string rom, out, symbols; int frames=36000, period=997, cycles=10; u64 seed=1; };
+  explicit Profiler(const Opt& o):opt(o){}
+  bool run(){
+    if(!opt.symbols.empty() && !loadSymbols(opt.symbols)) return false;
+    Chip8VM vm; if(!vm.load(opt.rom)) return false;
+    vm.setBeep(false); vm.seed(opt.seed);
+    Keypad keys; Rng input(opt.seed^0x4B455953ull); int until=opt.period; u64 samples=0; double sampleNs=0;
+    auto t0=std::chrono::steady_clock::now();
+    for(int f=0;f<opt.frames;++f){
+      randomKeys(input,keys,vm);
+      for(int left=opt.cycles;left>0;){
+        int n=std::min(left,until); vm.run(keys,n); left-=n; until-=n;
+        if(until) continue;
+        auto s0=std::chrono::steady_clock::now(); sample(vm.state()); ++samples; until=opt.period;
+        sampleNs+=std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now()-s0).count();
+      }
+      vm.timerTick();
+    }
+    double ns=std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now()-t0).count();
+    std::ofstream out(opt.out,std::ios::trunc);
+    for(const auto& [stack,count]:stacks){
+      for(size_t i=0;i<stack.size() && stack[i]!=kEnd;++i) out<<(i?";":"")<<name(stack[i]);
+      out<<" "<<count<<"\n";
+    }
+    if(!out){ std::cerr<<"profile write fail: "<<opt.out<<"\n"; return false; }
+    std::cout<<"profile: "<<samples<<" samples, "<<stacks.size()<<" distinct stacks, "<<vm.statistics().instructions<<" instructions; sampling took "
+             <<(ns>0?100*sampleNs/ns:0)<<"% of "<<ns/1e9<<"s\n";
+    return true;
+  }
  private:
-  State st{}; FB fb{}; bool waitKey=false; u8 waitReg=0;
+  static constexpr u16 kUnknown=0xFFFE, kEnd=0xFFFF;
+  using Stack=std::array<u16,chip8c::kStackDepth+2>;
+  void sample(const Chip8VM::State& st){
+    Stack s; s.fill(kEnd); size_t n=0; s[n++]=chip8c::kEntryAddr;
+    for(u8 i=0;i<st.sp;++i){
+      u16 at=(st.stack[i]-2)&chip8c::kAddrMask, op=u16(st.mem[at]<<8|st.mem[(at+1)&chip8c::kAddrMask]);
+      s[n++]=(op&0xF000)==0x2000?u16(op&0x0FFF):kUnknown;
+    }
+    if(!symbols.empty()){
+      auto it=symbols.upper_bound(st.pc&chip8c::kAddrMask);
+      if(it!=symbols.begin() && (--it)->first>s[n-1] && s[n-1]!=kUnknown) s[n++]=it->first;
+    }
+    ++stacks[s];
+  }
+  std::string name(u16 a)const{
+    if(a==kUnknown) return "?";
+    auto it=symbols.find(a); if(it!=symbols.end()) return it->second;
+    if(a==chip8c::kEntryAddr) return "main";
+    char b[16]; std::snprintf(b,sizeof b,"sub_%03X",a); return b;
+  }
+  bool loadSymbols(const std::string& path){
+    std::ifstream f(path); if(!f){ std::cerr<<"symbols open fail: "<<path<<"\n"; return false; }
+    std::string line; int no=0;
+    while(std::getline(f,line)){
+      ++no; size_t b=line.find_first_not_of(" \t"); if(b==std::string::npos || line[b]=='#') continue;
+      char* end=nullptr; unsigned long a=std::strtoul(line.c_str()+b,&end,16);
+      const char* p=end; while(*p && std::isspace(u8(*p))) ++p;
+      const char* q=p; while(*q && !std::isspace(u8(*q))) ++q;
+      std::string label(p,q);
+      if(end==line.c_str()+b || p==end || a>=chip8c::kMemSize || label.empty()){ std::cerr<<"symbols: bad line "<<no<<" in "<<path<<"\n"; return false; }
+      symbols[u16(a)]=label;
+    }
+    return true;
+  }
+  Opt opt; std::map<u16,std::string> symbols; std::map<Stack,u64> stacks;
+};
+
+// Input log of an App session: key edges and timer ticks stamped with the loop iteration (step) they happened in.
+// Within a step, key events come before run() and ticks after it; replaying that reproduces the session exactly.
+struct Recording {
+  enum Kind:u8{ kDown, kUp, kTick };
+  struct Event{ u32 step; u8 kind, key; u16 pad=0; };
+  struct Header{ u32 magic=kMagic, version=1; u64 romHash=0, seed=0; u32 cycles=10, steps=0, events=0, pad=0; };
+  static constexpr u32 kMagic=0x50523843;  // "C8RP"
+  Header h; std::vector<Event> events;
+  void note(u32 step,Kind k,u8 key=0){ events.push_back(Event{step,k,key}); }
+  bool save(const std::string& path){
+    h.events=u32(events.size());
+    std::ofstream f(path,std::ios::binary|std::ios::trunc);
+    f.write(reinterpret_cast<const char*>(&h),sizeof h); f.write(reinterpret_cast<const char*>(events.data()),std::streamsize(events.size()*sizeof(Event)));
+    if(!f){ std::cerr<<"recording write fail: "<<path<<"\n"; return false; } return true;
+  }
+  bool load(const std::string& path){
+    std::ifstream f(path,std::ios::binary|std::ios::ate); if(!f){ std::cerr<<"recording open fail: "<<path<<"\n"; return false; }
+    std::streamoff n=f.tellg(); f.seekg(0);
+    if(n<0 || !f.read(reinterpret_cast<char*>(&h),sizeof h) || h.magic!=kMagic || h.version!=1){ std::cerr<<"not a recording: "<<path<<"\n"; return false; }
+    if(u64(h.events)*sizeof(Event)>u64(n)-sizeof h){ std::cerr<<"recording truncated: "<<path<<"\n"; return false; }
+    events.resize(h.events);
+    if(!f.read(reinterpret_cast<char*>(events.data()),std::streamsize(events.size()*sizeof(Event)))){ std::cerr<<"recording truncated: "<<path<<"\n"; return false; }
+    for(size_t i=0;i<events.size();++i)
+      if(events[i].step>=h.steps || events[i].kind>kTick || (i && events[i].step<events[i-1].step)){ std::cerr<<"recording corrupt: "<<path<<"\n"; return false; }
+    return true;
+  }
 };
 
 class App {
  public:
-  struct Opt{ std::string rom; int sx=12,sy=12, timerHz=chip8c::kTimerHz, cycles=10; bool vsync=true; };
+  struct Opt{ std::string rom, record; int sx=12,sy=12, timerHz=chip8c::kTimerHz, cycles=10; bool vsync=true; u64 seed=1; };
   explicit App(const Opt& o):opt(o),disp(Display::Config{ "Chip8 VM"+o.rom, chip8c::kDisplayWidth, chip8c::kDisplayHeight, o.sx, o.sy, o.vsync }){}
   bool run(){
     if(!disp.init()) return false;
     if(!vm.load(opt.rom)) return false;
-    bool quit=false; u32 last=SDL_GetTicks(), dt=1000/opt.timerHz;
-    while(!quit){
+    vm.seed(opt.seed); rec.h.romHash=vm.imageHash(); rec.h.seed=opt.seed; rec.h.cycles=u32(opt.cycles);
+    bool quit=false; u32 last=SDL_GetTicks(), dt=1000/opt.timerHz, step=0;
+    for(;!quit;++step){
+      CHIP8_ALLOC_PHASE(kFrame);
       SDL_Event ev; while(SDL_PollEvent(&ev)){
         if(ev.type==SDL_QUIT) quit=true;
-        else if(ev.type==SDL_KEYDOWN){ if(ev.key.keysym.sym==SDLK_ESCAPE) quit=true; auto m=Keypad::map(ev.key.keysym.sym); if(m){ keys.set(*m,true); vm.feedKey(*m);} }
-        else if(ev.type==SDL_KEYUP){ auto m=Keypad::map(ev.key.keysym.sym); if(m) keys.set(*m,false); }
+        else if(ev.type==SDL_KEYDOWN){ if(ev.key.keysym.sym==SDLK_ESCAPE) quit=true; auto m=Keypad::map(ev.key.keysym.sym); if(m){ keys.set(*m,true); vm.feedKey(*m); rec.note(step,Recording::kDown,*m); } }
+        else if(ev.type==SDL_KEYUP){ auto m=Keypad::map(ev.key.keysym.sym); if(m){ keys.set(*m,false); rec.note(step,Recording::kUp,*m); } }
       }
-      bool draw=false; for(int i=0;i<opt.cycles;++i) draw|=vm.step(keys);
-      u32 now=SDL_GetTicks(); if(now-last>=dt){ vm.timerTick(); last=now; }
-      if(draw){ disp.clear(); const auto& fb=vm.framebuffer(); for(int y=0;y<chip8c::kDisplayHeight;++y) for(int x=0;x<chip8c::kDisplayWidth;++x) disp.pixel(x,y, fb.pix[y*chip8c::kDisplayWidth+x]!=0 ); disp.present(); }
+      bool draw=vm.run(keys,opt.cycles);
+      u32 now=SDL_GetTicks(); if(now-last>=dt){ vm.timerTick(); last=now; rec.note(step,Recording::kTick); }
+      if(draw){ CHIP8_ALLOC_PHASE(kRender); disp.clear(); const auto& fb=vm.framebuffer(); for(int y=0;y<chip8c::kDisplayHeight;++y) for(int x=0;x<chip8c::kDisplayWidth;++x) disp.pixel(x,y, fb.pix[y*chip8c::kDisplayWidth+x]!=0 ); disp.present(); }
       SDL_Delay(1);
+    }
+    rec.h.steps=step; return opt.record.empty() || rec.save(opt.record);
+  }
+ private: Opt opt; Display disp; Keypad keys; Chip8VM vm; Recording rec;
+};
+
+#ifdef CHIP8_HAVE_POSIX_IO
+// Asynchronous append-only output for traces, save states and frame dumps. Producers copy into fixed buffers and
+// hand full ones to a writer thread, which submits them in batches through io_uring with registered buffers
+// (Linux), or to a small pwrite() pool when io_uring is unavailable. Offsets are assigned at hand-off, so a file
+// may have many writes in flight; each file must have a single producer. Handing off a full buffer takes a short
+// lock to queue it and wakes a writer thread only if one is parked, so a producer makes no syscall while the
+// writers are busy; it blocks only when every buffer is in flight, which shows up as a stall.
+class Writer {
+ public:
+  struct Opt{ int buffers=64, threads=2, batch=16; size_t bufferSize=size_t(1)<<16; bool uring=true; };
+  struct Stats{ u64 bytes=0, writes=0, batches=0, stalls=0, errors=0; size_t depth=0, maxDepth=0, inflight=0, maxInflight=0; };
+  static constexpr int kMaxFiles=16, kMaxBatch=64;
+  explicit Writer(const Opt& o):opt(o),arena(new u8[size_t(o.buffers)*o.bufferSize]),bufs(size_t(o.buffers)),ready(size_t(o.buffers)){
+    spare.reserve(bufs.size());
+    for(size_t i=0;i<bufs.size();++i){ bufs[i].data=arena.get()+i*opt.bufferSize; spare.push_back(int(i)); }
+#ifdef CHIP8_HAVE_URING
+    if(opt.uring && ring.init(unsigned(opt.buffers),bufs,opt.bufferSize)){ threads.emplace_back([this]{ uringLoop(); }); return; }
+#endif
+    for(int i=0;i<std::max(1,opt.threads);++i) threads.emplace_back([this]{ poolLoop(); });
+  }
+  ~Writer(){ close(); }
+  Writer(const Writer&)=delete; Writer& operator=(const Writer&)=delete;
+  const char* backend()const{
+#ifdef CHIP8_HAVE_URING
+    if(ring.fd>=0) return "io_uring";
+#endif
+    return "threads";
+  }
+  int open(const std::string& path){
+    if(nfiles==kMaxFiles){ std::cerr<<"writer: too many files\n"; return -1; }
+    int fd=::open(path.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644); if(fd<0){ std::cerr<<"writer: cannot open "<<path<<"\n"; return -1; }
+    files[size_t(nfiles)]=File{fd,0,-1}; return nfiles++;
+  }
+  bool append(int file,const void* p,size_t n){
+    if(file<0||file>=nfiles) return false;
+    File& f=files[size_t(file)]; auto s=static_cast<const u8*>(p);
+    while(n){
+      if(f.cur<0){ f.cur=acquire(); if(f.cur<0) return false; }
+      Buffer& b=bufs[size_t(f.cur)]; size_t k=std::min(n,opt.bufferSize-b.size);
+      std::memcpy(b.data+b.size,s,k); b.size+=k; s+=k; n-=k;
+      if(b.size==opt.bufferSize) handOff(f);
     } return true;
   }
- private: Opt opt; Display disp; Keypad keys; Chip8VM vm;
+  // Hands off partial buffers and waits for every write to land.
+  bool flush(){
+    for(int i=0;i<nfiles;++i) if(files[size_t(i)].cur>=0) handOff(files[size_t(i)]);
+    std::unique_lock lk(mu); idle.wait(lk,[&]{ return !count && !stats.inflight; }); return !stats.errors;
+  }
+  bool close(){
+    bool ok=flush();
+    { std::lock_guard lk(mu); stop=true; } work.notify_all();
+    for(auto& t:threads) t.join();
+    threads.clear();
+    for(int i=0;i<nfiles;++i) ::close(files[size_t(i)].fd);
+    nfiles=0; return ok;
+  }
+  Stats statistics()const{ std::lock_guard lk(mu); return stats; }
+  static bool writeAll(int fd,const u8* p,size_t n,u64 off){
+    while(n){ ssize_t w=::pwrite(fd,p,n,off_t(off)); if(w<0){ if(errno==EINTR) continue; return false; } if(w==0) return false; p+=w; n-=size_t(w); off+=u64(w); }
+    return true;
+  }
+ private:
+  struct Buffer{ u8* data=nullptr; size_t size=0; int fd=-1; u64 off=0; };
+  struct File{ int fd=-1; u64 end=0; int cur=-1; };
+  int acquire(){
+    std::unique_lock lk(mu);
+    if(spare.empty()){ ++stats.stalls; idle.wait(lk,[&]{ return !spare.empty()||stop; }); if(spare.empty()) return -1; }
+    int b=spare.back(); spare.pop_back(); bufs[size_t(b)].size=0; return b;
+  }
+  void handOff(File& f){
+    Buffer& b=bufs[size_t(f.cur)]; b.fd=f.fd; b.off=f.end; f.end+=b.size;
+    bool wake;
+    { std::lock_guard lk(mu); ready[(head+count)%ready.size()]=f.cur; ++count; stats.maxDepth=std::max(stats.maxDepth,stats.depth=count); wake=parked>0; }
+    f.cur=-1; if(wake) work.notify_one();
+  }
+  int pop(){ int b=ready[head]; head=(head+1)%ready.size(); stats.depth=--count; ++stats.inflight; stats.maxInflight=std::max(stats.maxInflight,stats.inflight); return b; }
+  // Called with mu held once a buffer's write has finished (res is bytes written, or -errno).
+  void retire(int b,long res){
+    Buffer& x=bufs[size_t(b)];
+    if(res>=0 && size_t(res)<x.size && writeAll(x.fd,x.data+res,x.size-size_t(res),x.off+u64(res))) res=long(x.size);
+    if(res<0||size_t(res)!=x.size) ++stats.errors; else { stats.bytes+=x.size; ++stats.writes; }
+    --stats.inflight; spare.push_back(b);
+  }
+  void poolLoop(){
+    std::unique_lock lk(mu);
+    for(;;){
+      ++parked; work.wait(lk,[&]{ return count||stop; }); --parked;
+      if(!count) return;
+      int b=pop(); ++stats.batches; lk.unlock();
+      const Buffer& x=bufs[size_t(b)]; long res=writeAll(x.fd,x.data,x.size,x.off)?long(x.size):-1;
+      lk.lock(); retire(b,res); idle.notify_all();
+    }
+  }
+#ifdef CHIP8_HAVE_URING
+  // Just enough of io_uring for fixed-buffer writes, without liburing.
+  struct Ring{
+    int fd=-1; unsigned entries=0; void* sq=MAP_FAILED; void* cq=MAP_FAILED; size_t sqLen=0, cqLen=0;
+    io_uring_sqe* sqes=static_cast<io_uring_sqe*>(MAP_FAILED); size_t sqesLen=0;
+    unsigned *sqHead=nullptr,*sqTail=nullptr,*sqMask=nullptr,*sqArray=nullptr,*cqHead=nullptr,*cqTail=nullptr,*cqMask=nullptr; io_uring_cqe* cqes=nullptr;
+    bool init(unsigned n,const std::vector<Buffer>& bufs,size_t size){
+      io_uring_params p{}; fd=int(syscall(__NR_io_uring_setup,n,&p)); if(fd<0) return false;
+      entries=p.sq_entries; sqLen=p.sq_off.array+p.sq_entries*sizeof(unsigned); cqLen=p.cq_off.cqes+p.cq_entries*sizeof(io_uring_cqe);
+      bool single=p.features&IORING_FEAT_SINGLE_MMAP; if(single) sqLen=cqLen=std::max(sqLen,cqLen);
+      sq=mmap(nullptr,sqLen,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQ_RING);
+      cq=single?sq:mmap(nullptr,cqLen,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_CQ_RING);
+      sqesLen=p.sq_entries*sizeof(io_uring_sqe);
+      sqes=static_cast<io_uring_sqe*>(mmap(nullptr,sqesLen,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQES));
+      if(sq==MAP_FAILED||cq==MAP_FAILED||sqes==MAP_FAILED){ shut(); return false; }
+      auto at=[](void* base,u32 off){ return reinterpret_cast<unsigned*>(static_cast<u8*>(base)+off); };
+      sqHead=at(sq,p.sq_off.head); sqTail=at(sq,p.sq_off.tail); sqMask=at(sq,p.sq_off.ring_mask); sqArray=at(sq,p.sq_off.array);
+      cqHead=at(cq,p.cq_off.head); cqTail=at(cq,p.cq_off.tail); cqMask=at(cq,p.cq_off.ring_mask);
+      cqes=reinterpret_cast<io_uring_cqe*>(static_cast<u8*>(cq)+p.cq_off.cqes);
+      std::vector<iovec> iov; for(const auto& b:bufs) iov.push_back(iovec{b.data,size});
+      if(syscall(__NR_io_uring_register,fd,IORING_REGISTER_BUFFERS,iov.data(),unsigned(iov.size()))<0){ shut(); return false; }
+      return true;
+    }
+    void shut(){
+      if(sqes!=MAP_FAILED) munmap(sqes,sqesLen);
+      if(cq!=MAP_FAILED && cq!=sq) munmap(cq,cqLen);
+      if(sq!=MAP_FAILED) munmap(sq,sqLen);
+      if(fd>=0) ::close(fd);
+      fd=-1; sq=cq=MAP_FAILED; sqes=static_cast<io_uring_sqe*>(MAP_FAILED);
+    }
+    void push(int index,const Buffer& b){
+      unsigned t=*sqTail, i=t&*sqMask; io_uring_sqe& e=sqes[i]; e=io_uring_sqe{};
+      e.opcode=IORING_OP_WRITE_FIXED; e.fd=b.fd; e.off=b.off; e.addr=u64(uintptr_t(b.data)); e.len=u32(b.size); e.buf_index=u16(index); e.user_data=u64(index);
+      sqArray[i]=i; __atomic_store_n(sqTail,t+1,__ATOMIC_RELEASE);
+    }
+    bool enter(unsigned submit,unsigned wait){
+      for(;;){
+        long r=syscall(__NR_io_uring_enter,fd,submit,wait,wait?IORING_ENTER_GETEVENTS:0u,nullptr,0);
+        if(r>=0) return true;
+        if(errno!=EINTR) return false;
+      }
+    }
+    ~Ring(){ shut(); }
+  };
+  void uringLoop(){
+    std::unique_lock lk(mu);
+    for(;;){
+      if(!count && !stats.inflight){ if(stop) return; ++parked; work.wait(lk); --parked; continue; }
+      unsigned n=0; std::array<int,kMaxBatch> batch;
+      while(count && stats.inflight<ring.entries && n<unsigned(std::clamp(opt.batch,1,kMaxBatch))){ int b=pop(); ring.push(b,bufs[size_t(b)]); batch[n++]=b; }
+      if(n) ++stats.batches;
+      bool more=count && stats.inflight<ring.entries; lk.unlock();
+      bool ok=ring.enter(n,more?0:1);
+      if(!ok && n){  // nothing was consumed: take the entries back and write them here
+        __atomic_store_n(ring.sqTail,*ring.sqTail-n,__ATOMIC_RELEASE);
+        for(unsigned i=0;i<n;++i){ const Buffer& x=bufs[size_t(batch[i])]; long res=writeAll(x.fd,x.data,x.size,x.off)?long(x.size):-1; lk.lock(); retire(batch[i],res); lk.unlock(); }
+      }
+      lk.lock();
+      unsigned h=*ring.cqHead, t=__atomic_load_n(ring.cqTail,__ATOMIC_ACQUIRE);
+      for(;h!=t;++h){ const io_uring_cqe& c=ring.cqes[h&*ring.cqMask]; retire(int(c.user_data),long(c.res)); }
+      __atomic_store_n(ring.cqHead,h,__ATOMIC_RELEASE);
+      idle.notify_all();
+    }
+  }
+#endif
+  Opt opt; std::unique_ptr<u8[]> arena; std::vector<Buffer> bufs; std::vector<int> spare, ready; size_t head=0, count=0;
+  std::array<File,kMaxFiles> files{}; int nfiles=0, parked=0; bool stop=false; Stats stats;  // parked: writers waiting on work
+#ifdef CHIP8_HAVE_URING
+  Ring ring;  // after arena: unregistered before the buffers go away
+#endif
+  mutable std::mutex mu; std::condition_variable work, idle; std::vector<std::thread> threads;
+};
+#endif
+
+#ifdef CHIP8_HAVE_POSIX_IO
+// Renders a Recording to a Y4M video, one frame per timer tick. A first pass replays the session without output,
+// keeping a checkpoint every `every` ticks; workers then re-emulate and encode the segments between checkpoints in
+// parallel, and segments are written in order as soon as their predecessors are out.
+class Renderer {
+ public:
+  struct Opt{ std::string rom, recording, out; int scale=4, workers=0, every=600; };
+  explicit Renderer(const Opt& o):opt(o){}
+  bool run(){
+    if(!rec.load(opt.recording) || !image.load(opt.rom)) return false;
+    if(image.imageHash()!=rec.h.romHash){ std::cerr<<"recording was made with another ROM\n"; return false; }
+    auto t0=std::chrono::steady_clock::now();
+    Chip8VM vm; vm.cloneFrom(image); prepare(vm); Keypad keys; Cursor cur;
+    marks.push_back(Mark{vm.snapshot(),keys,cur,0});
+    while(cur.step<rec.h.steps){
+      u32 before=cur.ticks; advance(vm,keys,cur,cur.step+1,[](const Chip8VM&){});
+      if(cur.ticks/u32(opt.every)!=before/u32(opt.every)) marks.push_back(Mark{vm.snapshot(),keys,cur,vm.stateHash()});
+    }
+    if(marks.back().cur.step!=rec.h.steps) marks.push_back(Mark{vm.snapshot(),keys,cur,vm.stateHash()});
+    auto t1=std::chrono::steady_clock::now();
+    size_t segments=marks.size()-1; int workers=opt.workers>0?opt.workers:int(std::max(1u,std::thread::hardware_concurrency()));
+    Writer::Opt wo; Writer out(wo); int file=out.open(opt.out); if(file<0) return false;
+    const int w=chip8c::kDisplayWidth*opt.scale, ht=chip8c::kDisplayHeight*opt.scale;
+    char head[96]; int n=std::snprintf(head,sizeof head,"YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 Cmono\n",w,ht,chip8c::kTimerHz); out.append(file,head,size_t(n));
+    parts.assign(segments,Part{}); window=size_t(workers)*2;
+    std::vector<std::thread> pool; for(int i=0;i<workers;++i) pool.emplace_back([this]{ work(); });
+    bool ok=true;
+    for(size_t s=0;s<segments;++s){
+      std::unique_lock lk(mu); ready.wait(lk,[&]{ return parts[s].done; });
+      Part p=std::move(parts[s]); ++written; lk.unlock(); more.notify_all();
+      if(!p.ok){ std::cerr<<"segment "<<s<<" diverged from its checkpoint\n"; ok=false; }
+      out.append(file,p.bytes.data(),p.bytes.size());
+    }
+    for(auto& t:pool) t.join();
+    ok&=out.close();
+    auto t2=std::chrono::steady_clock::now(); double scan=std::chrono::duration<double>(t1-t0).count(), enc=std::chrono::duration<double>(t2-t1).count();
+    std::cout<<"render: "<<cur.ticks<<" frames ("<<cur.ticks/double(chip8c::kTimerHz)<<"s of play) in "<<segments<<" segments on "<<workers
+             <<" workers; scan "<<scan<<"s, encode "<<enc<<"s ("<<cur.ticks/std::max(enc,1e-9)<<" frames/s)\n";
+    return ok;
+  }
+ private:
+  struct Cursor{ u32 step=0, ticks=0; size_t event=0; };
+  struct Mark{ Chip8VM::Snapshot snap; Keypad keys; Cursor cur; u64 hash; };
+  struct Part{ std::vector<u8> bytes; bool done=false, ok=true; };
+  void prepare(Chip8VM& vm)const{ vm.setEngine(Chip8VM::Engine::Fast); vm.setBeep(false); vm.seed(rec.h.seed); }
+  // Replays whole steps until cur.step==end, calling emit after every tick.
+  template <typename Emit>
+  void advance(Chip8VM& vm,Keypad& keys,Cursor& cur,u32 end,Emit emit){
+    const auto& ev=rec.events;
+    for(;cur.step<end;++cur.step){
+      for(;cur.event<ev.size() && ev[cur.event].step==cur.step && ev[cur.event].kind!=Recording::kTick;++cur.event){
+        u8 k=ev[cur.event].key; if(ev[cur.event].kind==Recording::kDown){ keys.set(k,true); vm.feedKey(k); } else keys.set(k,false);
+      }
+      vm.run(keys,int(rec.h.cycles));
+      for(;cur.event<ev.size() && ev[cur.event].step==cur.step;++cur.event){ vm.timerTick(); ++cur.ticks; emit(vm); }
+    }
+  }
+  void work(){
+    Chip8VM vm; vm.cloneFrom(image); prepare(vm);
+    const int w=chip8c::kDisplayWidth*opt.scale;
+    for(;;){
+      size_t s;
+      { std::unique_lock lk(mu); more.wait(lk,[&]{ return next>=parts.size() || next<written+window; }); if(next>=parts.size()) return; s=next++; }
+      const Mark& a=marks[s]; const Mark& b=marks[s+1]; Keypad keys=a.keys; Cursor cur=a.cur; vm.restore(a.snap);
+      Part p; p.bytes.reserve(size_t(b.cur.ticks-a.cur.ticks)*(6+size_t(w)*chip8c::kDisplayHeight*opt.scale));
+      advance(vm,keys,cur,b.cur.step,[&](const Chip8VM& m){ encode(m.framebuffer(),p.bytes); });
+      p.ok=vm.stateHash()==b.hash; p.done=true;
+      { std::lock_guard lk(mu); parts[s]=std::move(p); } ready.notify_one();
+    }
+  }
+  void encode(const Chip8VM::FB& fb,std::vector<u8>& o)const{
+    static constexpr char kFrame[]="FRAME\n"; o.insert(o.end(),kFrame,kFrame+6);
+    const size_t sc=size_t(opt.scale), len=chip8c::kDisplayWidth*sc;
+    for(int y=0;y<chip8c::kDisplayHeight;++y){
+      size_t at=o.size(); o.resize(at+len*sc); u8* row=&o[at];
+      for(int x=0;x<chip8c::kDisplayWidth;++x) std::memset(row+size_t(x)*sc,fb.pix[y*chip8c::kDisplayWidth+x]?235:16,sc);
+      for(size_t r=1;r<sc;++r) std::memcpy(row+r*len,row,len);
+    }
+  }
+  Opt opt; Recording rec; Chip8VM image; std::vector<Mark> marks; std::vector<Part> parts; size_t next=0, written=0, window=0;
+  std::mutex mu; std::condition_variable ready, more;
+};
+
+// Bounded multi-producer multi-consumer queue (Vyukov): fixed capacity, one CAS per operation, no locks.
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity):cells(std::bit_ceil(std::max<size_t>(capacity,2))),mask(cells.size()-1){
+    for(size_t i=0;i<cells.size();++i) cells[i].seq.store(i,std::memory_order_relaxed);
+  }
+  bool tryPush(T v){
+    size_t pos=tail.load(std::memory_order_relaxed);
+    for(;;){
+      Cell& c=cells[pos&mask]; auto d=std::ptrdiff_t(c.seq.load(std::memory_order_acquire)-pos);
+      if(d==0){ if(tail.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed)){ c.value=v; c.seq.store(pos+1,std::memory_order_release); return true; } }
+      else if(d<0) return false;
+      else pos=tail.load(std::memory_order_relaxed);
+    }
+  }
+  bool tryPop(T& v){
+    size_t pos=head.load(std::memory_order_relaxed);
+    for(;;){
+      Cell& c=cells[pos&mask]; auto d=std::ptrdiff_t(c.seq.load(std::memory_order_acquire)-(pos+1));
+      if(d==0){ if(head.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed)){ v=c.value; c.seq.store(pos+mask+1,std::memory_order_release); return true; } }
+      else if(d<0) return false;
+      else pos=head.load(std::memory_order_relaxed);
+    }
+  }
+ private:
+  struct alignas(64) Cell{ std::atomic<size_t> seq{0}; T value{}; };
+  std::vector<Cell> cells; size_t mask;
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+};
+
+// Dataset/video production: many sessions with seeded random input, each rendered to its own Y4M file through four
+// stages with their own threads: emulate -> post-process (phosphor persistence, scaling) -> encode (RGB to 4:2:0)
+// -> write. Stages hand preallocated items through BoundedQueues, and a bounded free list gives backpressure, so
+// memory is fixed and emulator threads only ever wait for a free item, never for I/O. Frames land at fixed offsets,
+// so no stage has to keep order.
+class Pipeline {
+ public:
+  enum Stage{ kEmulate, kPost, kEncode, kWrite, kStageCount };
+  static constexpr const char* kStageNames[kStageCount]={"emulate","post","encode","write"};
+  static constexpr int kHistory=4;
+  struct Opt{ std::string rom, dir; int sessions=64, frames=600, scale=4, persistence=3, depth=64, cycles=10; std::array<int,kStageCount> threads{1,1,2,1}; u64 seed=1; };
+  explicit Pipeline(const Opt& o):opt(o),freeItems(size_t(o.depth)),queues{BoundedQueue<Item*>(size_t(o.depth)),BoundedQueue<Item*>(size_t(o.depth)),BoundedQueue<Item*>(size_t(o.depth))}{}
+  bool run(){
+    Chip8VM image; if(!image.load(opt.rom)) return false;
+    w=chip8c::kDisplayWidth*opt.scale; h=chip8c::kDisplayHeight*opt.scale; frameBytes=6+size_t(w*h)*3/2;
+    char head[96]; int n=std::snprintf(head,sizeof head,"YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",w,h,chip8c::kTimerHz); headBytes=size_t(n);
+    for(int s=0;s<opt.sessions;++s){
+      auto x=std::make_unique<Session>(); x->vm.cloneFrom(image); x->vm.setEngine(Chip8VM::Engine::Fast); x->vm.setBeep(false);
+      x->vm.seed(Rng::jobSeed(opt.seed,u64(s))); x->input=Rng(Rng::jobSeed(opt.seed^0x4B455953ull,u64(s)));
+      char name[32]; std::snprintf(name,sizeof name,"/session_%04d.y4m",s);
+      x->fd=::open((opt.dir+name).c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+      if(x->fd<0 || !Writer::writeAll(x->fd,reinterpret_cast<const u8*>(head),headBytes,0)){ std::cerr<<"pipeline: cannot write "<<opt.dir<<name<<"\n"; return false; }
+      sessions.push_back(std::move(x));
+    }
+    items.resize(size_t(opt.depth));
+    for(auto& it:items){ it.rgb.resize(size_t(w*h)*3); it.yuv.resize(frameBytes); freeItems.tryPush(&it); }
+    for(int s=0;s<kStageCount;++s){ opt.threads[size_t(s)]=std::max(1,opt.threads[size_t(s)]); left[s]=opt.threads[size_t(s)]; }
+    auto t0=std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for(int s=0;s<kStageCount;++s) for(int t=0;t<opt.threads[size_t(s)];++t) pool.emplace_back([this,s,t]{ worker(Stage(s),t); });
+    for(auto& t:pool) t.join();
+    double wall=std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count(); u64 total=u64(opt.sessions)*u64(opt.frames);
+    std::cout<<"pipeline: "<<opt.sessions<<" sessions x "<<opt.frames<<" frames in "<<wall<<"s ("<<total/wall<<" frames/s)\n";
+    for(int s=0;s<kStageCount;++s){
+      const auto& x=stats[s]; double cap=wall*1e9*opt.threads[size_t(s)];
+      std::cout<<"stage "<<kStageNames[s]<<": threads="<<opt.threads[size_t(s)]<<" items="<<x.items<<" busy="<<100*x.busyNs/cap<<"% starved="<<100*x.starvedNs/cap
+               <<"% blocked="<<100*x.blockedNs/cap<<"%\n";
+    }
+    bool ok=!errors.load(); for(auto& x:sessions) ok&=::close(x->fd)==0;
+    return ok;
+  }
+ private:
+  struct Session{ Chip8VM vm; Keypad keys; Rng input; std::array<Chip8VM::FB,kHistory> ring{}; int fd=-1; };
+  struct Item{ u32 session=0, frame=0; std::array<Chip8VM::FB,kHistory> hist{}; std::vector<u8> rgb, yuv; };
+  struct Stats{ std::atomic<u64> items{0}, busyNs{0}, starvedNs{0}, blockedNs{0}; };
+  using Clock=std::chrono::steady_clock;
+  static u64 since(Clock::time_point& t){ auto n=Clock::now(); u64 d=u64(std::chrono::duration_cast<std::chrono::nanoseconds>(n-t).count()); t=n; return d; }
+  static void backoff(int& spins){ if(++spins<64) return; if(spins<256) std::this_thread::yield(); else std::this_thread::sleep_for(std::chrono::microseconds(20)); }
+  static Item* take(BoundedQueue<Item*>& q){ Item* it=nullptr; for(int spins=0;!q.tryPop(it);) backoff(spins); return it; }
+  static void give(BoundedQueue<Item*>& q,Item* it){ for(int spins=0;!q.tryPush(it);) backoff(spins); }
+  // Each stage reads from its input queue (the free list for emulate) and writes to the next (the free list for
+  // write); nullptr marks the end and is passed on once per downstream thread by the stage's last thread.
+  void worker(Stage s,int t){
+    BoundedQueue<Item*>& in=s==kEmulate?freeItems:queues[s-1];
+    BoundedQueue<Item*>& out=s==kWrite?freeItems:queues[s];
+    u64 busy=0, starved=0, blocked=0, done=0; Clock::time_point at=Clock::now();
+    if(s==kEmulate){
+      for(int f=0;f<opt.frames;++f) for(size_t x=size_t(t);x<sessions.size();x+=size_t(opt.threads[kEmulate])){
+        Item* it=take(in); blocked+=since(at);
+        emulate(*sessions[x],*it,u32(x),u32(f)); busy+=since(at);
+        give(queues[kEmulate],it); blocked+=since(at); ++done;
+      }
+    } else for(;;){
+      Item* it=take(in); starved+=since(at);
+      if(!it) break;
+      if(s==kPost) post(*it); else if(s==kEncode) encode(*it); else write(*it);
+      busy+=since(at); give(out,it); blocked+=since(at); ++done;
+    }
+    stats[s].items+=done; stats[s].busyNs+=busy; stats[s].starvedNs+=starved; stats[s].blockedNs+=blocked;
+    if(--left[s]==0 && s!=kWrite) for(int i=0;i<opt.threads[size_t(s)+1];++i) give(queues[s],nullptr);
+  }
+  void emulate(Session& x,Item& it,u32 session,u32 frame){
+    randomKeys(x.input,x.keys,x.vm);
+    x.vm.frame(x.keys,opt.cycles);
+    std::move_backward(x.ring.begin(),x.ring.end()-1,x.ring.end()); x.ring[0]=x.vm.framebuffer();
+    it.session=session; it.frame=frame; it.hist=x.ring;
+  }
+  // A pixel lit k frames ago glows at 1/2^k of full brightness, up to `persistence` frames; then each is scaled up.
+  void post(Item& it){
+    static constexpr u8 kPhosphor[3]={0x33,0xFF,0x66};
+    const int depth=clamp(opt.persistence,0,kHistory-1), sc=opt.scale;
+    for(int y=0;y<chip8c::kDisplayHeight;++y) for(int x=0;x<chip8c::kDisplayWidth;++x){
+      int p=y*chip8c::kDisplayWidth+x, k=0; while(k<=depth && !it.hist[size_t(k)].pix[size_t(p)]) ++k;
+      u8 c[3]; for(int i=0;i<3;++i) c[i]=k>depth?0:u8(kPhosphor[i]>>k);
+      for(int dy=0;dy<sc;++dy){ u8* o=&it.rgb[(size_t((y*sc+dy)*w)+size_t(x*sc))*3]; for(int dx=0;dx<sc;++dx,o+=3) std::memcpy(o,c,3); }
+    }
+  }
+  // Full-range BT.601, chroma averaged over 2x2 blocks.
+  void encode(Item& it){
+    u8* o=it.yuv.data(); std::memcpy(o,"FRAME\n",6); u8* Y=o+6; u8* U=Y+w*h; u8* V=U+w*h/4; const u8* p=it.rgb.data();
+    for(int i=0;i<w*h;++i) Y[i]=u8((77*p[3*i]+150*p[3*i+1]+29*p[3*i+2])>>8);
+    for(int y=0;y<h;y+=2) for(int x=0;x<w;x+=2){
+      int r=0,g=0,b=0; for(int d:{0,1,w,w+1}){ const u8* q=p+3*(y*w+x+d); r+=q[0]; g+=q[1]; b+=q[2]; }
+      size_t c=size_t(y/2*(w/2)+x/2); U[c]=u8(clamp((-43*r-85*g+128*b+(128<<10))>>10,0,255)); V[c]=u8(clamp((128*r-107*g-21*b+(128<<10))>>10,0,255));
+    }
+  }
+  void write(const Item& it){
+    if(!Writer::writeAll(sessions[it.session]->fd,it.yuv.data(),frameBytes,headBytes+u64(it.frame)*frameBytes)) ++errors;
+  }
+  Opt opt; BoundedQueue<Item*> freeItems; std::array<BoundedQueue<Item*>,kStageCount-1> queues;
+  std::vector<std::unique_ptr<Session>> sessions; std::vector<Item> items; int w=0, h=0; size_t frameBytes=0, headBytes=0;
+  Stats stats[kStageCount]; std::atomic<int> left[kStageCount]{}; std::atomic<u64> errors{0};
+};
+
+// Columnar per-frame telemetry. Each selected value (a register, I, pc, sp, timers, a memory byte, the framebuffer
+// digest or the key mask) is a typed column; record() stores one value per column into the open block, and full
+// blocks are delta/xor + zero-run varint coded and handed to the async Writer. The footer indexes every block with
+// its offset and min/max, so TelemetryReader can map the file and scan one column without touching the others.
+namespace telemetry {
+  enum Type:u8{ kU8, kU16, kU64 };
+  enum Codec:u8{ kDelta, kXor };
+  constexpr u32 kMagic=0x4C543843, kVersion=1;  // "C8TL"
+  struct FileHeader{ u32 magic=kMagic, version=kVersion, columns=0, blockRows=0; };
+  struct ColumnInfo{ char name[16]{}; u8 type=kU8, codec=kDelta; u8 pad[6]{}; u64 blocks=0; };
+  struct BlockInfo{ u64 offset=0, min=0, max=0; u32 bytes=0, rows=0; };
+  struct Trailer{ u64 footer=0; u32 magic=kMagic, pad=0; };
+  inline void putVar(std::vector<u8>& o,u64 x){ while(x>=0x80){ o.push_back(u8(x|0x80)); x>>=7; } o.push_back(u8(x)); }
+  inline u64 getVar(const u8*& p,const u8* end){ u64 x=0; for(int s=0;p<end && s<64;s+=7){ u8 b=*p++; x|=u64(b&0x7F)<<s; if(!(b&0x80)) break; } return x; }
+  inline u64 token(Codec c,u64 v,u64 prev){ if(c==kXor) return v^prev; i64 d=i64(v-prev); return (u64(d)<<1)^u64(d>>63); }
+  inline u64 untoken(Codec c,u64 t,u64 prev){ if(c==kXor) return prev^t; return prev+((t>>1)^(~(t&1)+1)); }
+  // A value equal to its predecessor codes as token 0, and a run of those as 0 followed by the run length minus one.
+  inline void encode(Codec c,const u64* v,size_t n,std::vector<u8>& o){
+    for(size_t i=0;i<n;){
+      u64 t=token(c,v[i],i?v[i-1]:0);
+      if(t){ putVar(o,t); ++i; continue; }
+      size_t j=i+1; while(j<n && v[j]==v[j-1]) ++j;
+      putVar(o,0); putVar(o,j-i-1); i=j;
+    }
+  }
+  template <typename Fn>
+  bool decode(Codec c,const u8* p,const u8* end,u32 rows,Fn&& fn){
+    u64 prev=0;
+    for(u32 r=0;r<rows;){
+      if(p>=end) return false;
+      u64 t=getVar(p,end);
+      if(t){ prev=untoken(c,t,prev); fn(prev); ++r; continue; }
+      u64 run=getVar(p,end)+1; if(run>rows-r) return false;
+      for(u64 k=0;k<run;++k) fn(prev);
+      r+=u32(run);
+    }
+    return p==end;
+  }
+}
+
+class Telemetry {
+ public:
+  static constexpr u32 kBlockRows=1u<<16;
+  static constexpr const char* kDefaultColumns="pc,I,sp,dt,st,v0,v1,v2,v3,v4,v5,v6,v7,v8,v9,vA,vB,vC,vD,vE,vF,keys,fb";
+  Telemetry():out(Writer::Opt{}){}
+  // Columns are comma separated: v0..vF, I, pc, sp, dt, st, keys, fb or m<hex address> (a memory byte).
+  bool open(const std::string& path,std::string_view spec=kDefaultColumns){
+    cols.clear();
+    while(!spec.empty()){
+      size_t comma=spec.find(','); std::string_view n=spec.substr(0,comma); spec=comma==spec.npos?std::string_view{}:spec.substr(comma+1);
+      auto c=parse(n); if(!c){ std::cerr<<"telemetry: unknown column "<<n<<"\n"; return false; }
+      cols.push_back(std::move(*c));
+    }
+    if(cols.empty()){ std::cerr<<"telemetry: no columns\n"; return false; }
+    file=out.open(path); if(file<0) return false;
+    telemetry::FileHeader h; h.columns=u32(cols.size()); h.blockRows=kBlockRows; append(&h,sizeof h);
+    for(auto& c:cols){ c.buf.reset(new u64[kBlockRows]); c.blocks.reserve(64); }
+    scratch.reserve(size_t(kBlockRows)*10+16); return true;
+  }
+  void record(const Chip8VM& vm,const Keypad& keys,bool drew){
+    const auto& s=vm.state(); if(drew) digest=vm.fbHash();
+    u64 mask=0; if(wantKeys) for(u8 k=0;k<chip8c::kKeyCount;++k) mask|=u64(keys.down(k))<<k;
+    for(auto& c:cols){
+      u64 v=0;
+      switch(c.kind){
+        case kReg: v=s.v[c.arg]; break; case kI: v=s.I; break; case kPc: v=s.pc; break; case kSp: v=s.sp; break;
+        case kDt: v=s.DT; break; case kSt: v=s.ST; break; case kMem: v=s.mem[c.arg]; break; case kKeys: v=mask; break; case kFb: v=digest; break;
+      }
+      c.buf[row]=v;
+    }
+    if(++row==kBlockRows) flush();
+  }
+  bool close(){
+    if(file<0) return false;
+    if(row) flush();
+    u64 footer=offset;
+    for(auto& c:cols){ telemetry::ColumnInfo ci; std::memcpy(ci.name,c.name.data(),std::min(c.name.size(),sizeof ci.name-1)); ci.type=c.type; ci.codec=c.codec; ci.blocks=c.blocks.size(); append(&ci,sizeof ci); }
+    for(auto& c:cols) append(c.blocks.data(),c.blocks.size()*sizeof(telemetry::BlockInfo));
+    telemetry::Trailer t; t.footer=footer; append(&t,sizeof t);
+    file=-1; return out.close();
+  }
+  u64 rows()const{ return total+row; }
+  u64 bytes()const{ return offset; }
+ private:
+  enum Kind:u8{ kReg, kI, kPc, kSp, kDt, kSt, kMem, kKeys, kFb };
+  struct Column{ std::string name; Kind kind; u16 arg=0; telemetry::Type type; telemetry::Codec codec=telemetry::kDelta; std::unique_ptr<u64[]> buf; std::vector<telemetry::BlockInfo> blocks; };
+  std::optional<Column> parse(std::string_view n){
+    using namespace telemetry;
+    auto make=[&](Kind k,Type t,u16 arg=0){ Column c; c.name=std::string(n); c.kind=k; c.type=t; c.arg=arg; if(k==kFb) c.codec=kXor; if(k==kKeys) wantKeys=true; return c; };
+    static constexpr std::pair<std::string_view,std::pair<Kind,Type>> kNamed[]={
+      {"I",{kI,kU16}},{"pc",{kPc,kU16}},{"sp",{kSp,kU8}},{"dt",{kDt,kU8}},{"st",{kSt,kU8}},{"keys",{kKeys,kU16}},{"fb",{kFb,kU64}}};
+    for(const auto& [name,kt]:kNamed) if(n==name) return make(kt.first,kt.second);
+    auto hex=[](std::string_view h,unsigned limit)->std::optional<u16>{
+      if(h.empty()||h.size()>3) return std::nullopt;
+      unsigned x=0;
+      for(char ch:h){ int d=ch>='0'&&ch<='9'?ch-'0':ch>='a'&&ch<='f'?ch-'a'+10:ch>='A'&&ch<='F'?ch-'A'+10:-1; if(d<0) return std::nullopt; x=x*16+unsigned(d); }
+      return x<limit?std::optional<u16>(u16(x)):std::nullopt;
+    };
+    if(n.size()==2 && n[0]=='v')
+      if(auto r=hex(n.substr(1),chip8c::kRegCount)) return make(kReg,kU8,*r);
+    if(n.size()>1 && n[0]=='m')
+      if(auto a=hex(n.substr(1),chip8c::kMemSize)) return make(kMem,kU8,*a);
+    return std::nullopt;
+  }
+  void append(const void* p,size_t n){ out.append(file,p,n); offset+=n; }
+  void flush(){
+    for(auto& c:cols){
+      telemetry::BlockInfo b; b.offset=offset; b.rows=row; b.min=~0ull;
+      for(u32 i=0;i<row;++i){ b.min=std::min(b.min,c.buf[i]); b.max=std::max(b.max,c.buf[i]); }
+      scratch.clear(); telemetry::encode(c.codec,c.buf.get(),row,scratch); b.bytes=u32(scratch.size());
+      append(scratch.data(),scratch.size()); c.blocks.push_back(b);
+    }
+    total+=row; row=0;
+  }
+  Writer out; int file=-1; std::vector<Column> cols; std::vector<u8> scratch; u32 row=0; u64 total=0, offset=0, digest=0; bool wantKeys=false;
 };
 
-static void usage(const char* a){ std::cout<<"Usage: "<<a<<" <rom_path> [scale]\n"; }
+// Maps a telemetry file read-only and decodes single columns block by block.
+class TelemetryReader {
+ public:
+  ~TelemetryReader(){ if(base!=MAP_FAILED) munmap(base,len); }
+  bool open(const std::string& path){
+    int fd=::open(path.c_str(),O_RDONLY); if(fd<0){ std::cerr<<"telemetry: cannot open "<<path<<"\n"; return false; }
+    struct stat sb{}; if(fstat(fd,&sb)==0) len=size_t(sb.st_size);
+    base=len?mmap(nullptr,len,PROT_READ,MAP_PRIVATE,fd,0):MAP_FAILED; ::close(fd);
+    if(base==MAP_FAILED){ std::cerr<<"telemetry: cannot map "<<path<<"\n"; return false; }
+    const u8* p=static_cast<const u8*>(base); telemetry::FileHeader h; telemetry::Trailer t;
+    if(len<sizeof h+sizeof t){ std::cerr<<"telemetry: truncated\n"; return false; }
+    std::memcpy(&h,p,sizeof h); std::memcpy(&t,p+len-sizeof t,sizeof t);
+    if(h.magic!=telemetry::kMagic || h.version!=telemetry::kVersion || t.magic!=telemetry::kMagic || t.footer>len-sizeof t){ std::cerr<<"telemetry: bad header\n"; return false; }
+    size_t at=size_t(t.footer), end=len-sizeof t;
+    if(h.columns>(end-at)/sizeof(telemetry::ColumnInfo)){ std::cerr<<"telemetry: bad footer\n"; return false; }
+    cols.resize(h.columns); std::memcpy(cols.data(),p+at,cols.size()*sizeof(telemetry::ColumnInfo)); at+=cols.size()*sizeof(telemetry::ColumnInfo);
+    for(const auto& c:cols){
+      if(c.blocks>(end-at)/sizeof(telemetry::BlockInfo)){ std::cerr<<"telemetry: bad footer\n"; return false; }
+      std::vector<telemetry::BlockInfo> b(size_t(c.blocks)); std::memcpy(b.data(),p+at,b.size()*sizeof(telemetry::BlockInfo)); at+=b.size()*sizeof(telemetry::BlockInfo);
+      for(const auto& x:b) if(x.offset>t.footer || x.bytes>t.footer-x.offset){ std::cerr<<"telemetry: bad block\n"; return false; }
+      blocks.push_back(std::move(b));
+    }
+    return true;
+  }
+  int find(std::string_view name)const{ for(size_t i=0;i<cols.size();++i) if(name==cols[i].name) return int(i); return -1; }
+  const std::vector<telemetry::BlockInfo>& index(int c)const{ return blocks[size_t(c)]; }
+  // Calls fn(value) for every row of column c, in order; returns false on a corrupt block.
+  template <typename Fn>
+  bool scan(int c,Fn&& fn)const{
+    const u8* p=static_cast<const u8*>(base);
+    for(const auto& b:blocks[size_t(c)]) if(!telemetry::decode(telemetry::Codec(cols[size_t(c)].codec),p+b.offset,p+b.offset+b.bytes,b.rows,fn)) return false;
+    return true;
+  }
+ private:
+  void* base=MAP_FAILED; size_t len=0; std::vector<telemetry::ColumnInfo> cols; std::vector<std::vector<telemetry::BlockInfo>> blocks;
+};
+#endif
+
+// Runs a ROM without SDL for a fixed number of frames, with the beep muted; with CHIP8_ALLOC_COUNT it fails on
+// steady-state allocations.
+class Headless {
+ public:
+  struct Opt{ std::string rom; int frames=600, cycles=10, warmup=1, memoVerify=-1, snapshotEvery=60; Chip8VM::Engine engine=Chip8VM::Engine::Tiered; };
+  // One per frame in trace.raw; frames.raw holds one byte per pixel per frame, states.raw raw Snapshots.
+  struct TraceRecord{ u64 instructions; u32 frame; u16 pc, I; };
+  explicit Headless(const Opt& o):opt(o){ vm.setBeep(false); }
+  bool run(){
+    std::cout<<"headless: "<<opt.rom<<" frames="<<opt.frames<<" cycles="<<opt.cycles<<std::endl;
+    if(!vm.load(opt.rom)) return false;
+    vm.setEngine(opt.engine); if(opt.memoVerify>=0) vm.enableMemo(opt.memoVerify);
+    const char* cacheDir=std::getenv("CHIP8_JIT_CACHE");
+    if(cacheDir){ bool warm=vm.openTranslationCache(cacheDir); std::cout<<"jit cache: "<<(warm?"warm":"cold")<<std::endl; }
+#ifdef CHIP8_HAVE_POSIX_IO
+    const char* dumpDir=std::getenv("CHIP8_DUMP"); std::optional<Writer> out; int frameOut=-1, stateOut=-1, traceOut=-1;
+    if(dumpDir){
+      Writer::Opt w; if(const char* b=std::getenv("CHIP8_DUMP_BACKEND")) w.uring=std::string_view(b)!="threads";
+      out.emplace(w); std::string d=dumpDir;
+      frameOut=out->open(d+"/frames.raw"); stateOut=out->open(d+"/states.raw"); traceOut=out->open(d+"/trace.raw");
+      if(frameOut<0||stateOut<0||traceOut<0) return false;
+    }
+    const char* telPath=std::getenv("CHIP8_TELEMETRY"); std::optional<Telemetry> tel;
+    if(telPath){
+      const char* cols=std::getenv("CHIP8_TELEMETRY_COLUMNS");
+      tel.emplace(); if(!tel->open(telPath,cols?cols:Telemetry::kDefaultColumns)) return false;
+    }
+#endif
+    [[maybe_unused]] u64 base[allocstat::kPhaseCount]{}; u64 digest=0;
+    for(int f=0;f<opt.frames;++f){
+      if(f==opt.warmup) for(int p=0;p<allocstat::kPhaseCount;++p) base[p]=allocstat::get(allocstat::Phase(p));
+      CHIP8_ALLOC_PHASE(kFrame);
+      bool draw=vm.frame(keys,opt.cycles);
+#ifdef CHIP8_HAVE_POSIX_IO
+      if(out){
+        TraceRecord t{vm.statistics().instructions,u32(f),vm.state().pc,vm.state().I}; out->append(traceOut,&t,sizeof t);
+        out->append(frameOut,vm.framebuffer().pix.data(),chip8c::kPixelCount);
+        if(f%opt.snapshotEvery==0){ auto snap=vm.snapshot(); out->append(stateOut,&snap,sizeof snap); }
+      }
+      if(tel) tel->record(vm,keys,draw);
+#endif
+      if(draw){ CHIP8_ALLOC_PHASE(kRender); digest=fnv1a(vm.framebuffer().pix.data(),chip8c::kPixelCount,digest); }
+    }
+    const auto& s=vm.statistics();
+    std::cout<<"pc="<<vm.state().pc<<" fb_digest="<<std::hex<<digest<<" state="<<vm.stateHash()<<std::dec
+             <<" instructions="<<s.instructions<<" dispatches/frame="<<double(s.dispatches)/opt.frames<<" fused="<<s.fused<<" loop_skipped="<<s.loopSkipped<<"\n";
+    if(opt.engine==Chip8VM::Engine::Tiered)
+      for(int t=0;t<Chip8VM::kTierCount;++t) std::cout<<"tier "<<Chip8VM::kTierNames[t]<<": instructions="<<s.tierInstructions[t]<<" ms="<<s.tierNanos[t]/1e6<<"\n";
+    if(cacheDir && !vm.saveTranslationCache()) return false;
+#ifdef CHIP8_HAVE_POSIX_IO
+    if(out){
+      bool ok=out->flush(); auto w=out->statistics();
+      std::cout<<"dump "<<out->backend()<<": bytes="<<w.bytes<<" writes="<<w.writes<<" batches="<<w.batches<<" max_queue="<<w.maxDepth
+               <<" max_inflight="<<w.maxInflight<<" stalls="<<w.stalls<<" errors="<<w.errors<<"\n";
+      if(!ok) return false;
+    }
+    if(tel){ u64 rows=tel->rows(); if(!tel->close()) return false; std::cout<<"telemetry: rows="<<rows<<" bytes="<<tel->bytes()<<"\n"; }
+#endif
+    if(opt.memoVerify>=0) std::cout<<"memo hits="<<s.memoHits<<" misses="<<s.memoMisses<<" verified="<<s.memoVerified<<" mismatches="<<s.memoMismatches<<"\n";
+    if(s.memoMismatches){ std::cerr<<"memoised calls disagreed with re-execution\n"; return false; }
+#ifdef CHIP8_ALLOC_COUNT
+    bool clean=true;
+    for(int p=0;p<allocstat::kPhaseCount;++p){
+      u64 total=allocstat::get(allocstat::Phase(p)), steady=total-base[p];
+      std::cout<<"alloc "<<allocstat::kPhaseNames[p]<<": total="<<total<<" steady="<<steady<<"\n";
+      if(steady && (p==allocstat::kFrame||p==allocstat::kStep||p==allocstat::kRender)) clean=false;
+    }
+    if(!clean){ std::cerr<<"steady-state allocations detected\n"; return false; }
+#endif
+    return true;
+  }
+ private: Opt opt; Keypad keys; Chip8VM vm;
+};
+
+// Runs the reference interpreter (step()) and a candidate engine side by side on the same ROM and key schedule,
+// comparing State and FB every `grain` instructions (0: once per frame). A divergent frame is replayed from its
+// start one instruction at a time to name the first bad instruction. "random:N" stands for N random ROMs.
+class Lockstep {
+ public:
+  struct Opt{ std::vector<std::string> roms; Chip8VM::Engine engine=Chip8VM::Engine::Jit; int frames=3000, cycles=10, grain=0; bool watch=false; };
+  explicit Lockstep(const Opt& o):opt(o){}
+  bool run(){
+    int bad=0, total=0;
+    for(const auto& r:opt.roms){
+      if(r.rfind("random:",0)==0){ int n=std::max(0,std::atoi(r.c_str()+7)); for(int s=0;s<n;++s,++total) bad+=!check("random#"+std::to_string(s),u64(s)); }
+      else { bad+=!check(r,0); ++total; }
+    }
+    std::cout<<"lockstep: "<<total-bad<<"/"<<total<<" ROMs match, "<<instructions<<" instructions compared\n";
+    return bad==0;
+  }
+ private:
+  static std::vector<u8> randomImage(u64 seed){
+    Rng g(seed); std::vector<u8> img(chip8c::kMemSize-chip8c::kEntryAddr);
+    for(size_t i=0;i<img.size();i+=2){
+      u8 hi=u8(g.next()), lo=u8(g.next()), top=hi>>4;
+      if(top==0x0){ u32 c=g.below(4); hi=0; lo=c==0?0xE0:c==1?0xEE:lo; }
+      else if(top==0x1||top==0x2||top==0xB) hi=u8((hi&0xF0)|(2+g.below(2)));
+      img[i]=hi; img[i+1]=lo;
+    }
+    return img;
+  }
+  static bool same(const Chip8VM& a,const Chip8VM& b){
+    const auto& s=a.state(); const auto& t=b.state();
+    return s.pc==t.pc && s.I==t.I && s.sp==t.sp && s.DT==t.DT && s.ST==t.ST && s.v==t.v && s.stack==t.stack && s.mem==t.mem && a.framebuffer().pix==b.framebuffer().pix;
+  }
+  static void diff(const Chip8VM& a,const Chip8VM& b){
+    const auto& s=a.state(); const auto& t=b.state(); int shown=0;
+    auto field=[](const char* name,int ref,int got){ if(ref!=got) std::cout<<"  "<<name<<": ref="<<std::hex<<ref<<" got="<<got<<std::dec<<"\n"; };
+    field("pc",s.pc,t.pc); field("I",s.I,t.I); field("sp",s.sp,t.sp); field("DT",s.DT,t.DT); field("ST",s.ST,t.ST);
+    for(int r=0;r<chip8c::kRegCount;++r){ char n[4]; std::snprintf(n,sizeof n,"V%X",r); field(n,s.v[r],t.v[r]); }
+    for(int i=0;i<chip8c::kStackDepth;++i) if(s.stack[i]!=t.stack[i]){ std::string n="stack["+std::to_string(i)+"]"; field(n.c_str(),s.stack[i],t.stack[i]); }
+    for(int a2=0;a2<chip8c::kMemSize && shown<8;++a2) if(s.mem[a2]!=t.mem[a2]){ std::cout<<"  mem["<<std::hex<<a2<<"]: ref="<<int(s.mem[a2])<<" got="<<int(t.mem[a2])<<std::dec<<"\n"; ++shown; }
+    int px=0; for(int i=0;i<chip8c::kPixelCount;++i) px+=a.framebuffer().pix[i]!=b.framebuffer().pix[i];
+    if(px) std::cout<<"  fb: "<<px<<" pixels differ\n";
+  }
+  // "hex:A300F065..." is an image given inline, for small cases that are easier to write than to ship.
+  static bool hexImage(const std::string& s,std::vector<u8>& img){
+    img.clear(); if(s.size()%2) return false;
+    for(size_t i=0;i<s.size();i+=2){
+      unsigned v; if(std::sscanf(s.c_str()+i,"%2x",&v)!=1 || !std::isxdigit(u8(s[i])) || !std::isxdigit(u8(s[i+1]))) return false;
+      img.push_back(u8(v));
+    }
+    return !img.empty();
+  }
+  static bool sameHit(const Chip8VM::WatchHit& a,const Chip8VM::WatchHit& b){ return a.pc==b.pc && a.addr==b.addr && a.kind==b.kind && a.before==b.before && a.after==b.after; }
+  static u16 opAt(const Chip8VM& vm){ const auto& s=vm.state(); return u16((s.mem[s.pc&chip8c::kAddrMask]<<8)|s.mem[(s.pc+1)&chip8c::kAddrMask]); }
+  bool check(const std::string& name,u64 seed){
+    Chip8VM ref, cand; bool loaded;
+    std::vector<u8> img;
+    if(name.rfind("random#",0)==0){ img=randomImage(seed); loaded=ref.loadImage(img.data(),img.size()) && cand.loadImage(img.data(),img.size()); }
+    else if(name.rfind("hex:",0)==0){
+      if(!hexImage(name.substr(4),img)){ std::cerr<<"bad hex image: "<<name<<"\n"; return false; }
+      loaded=ref.loadImage(img.data(),img.size()) && cand.loadImage(img.data(),img.size());
+    }
+    else loaded=ref.load(name) && cand.load(name);
+    if(!loaded) return false;
+    ref.setEngine(Chip8VM::Engine::Step); cand.setEngine(opt.engine); ref.setBeep(false); cand.setBeep(false); ref.seed(seed); cand.seed(seed);
+    std::vector<Chip8VM::WatchHit> refHits, candHits;
+    if(opt.watch) for(auto [vm,hits]:{std::pair{&ref,&refHits},std::pair{&cand,&candHits}}){
+      vm->watchMemory(0,chip8c::kMemSize,Chip8VM::kWatchRead|Chip8VM::kWatchWrite); vm->onWatch([hits](const Chip8VM::WatchHit& h){ hits->push_back(h); });
+    }
+    Rng input(fnv1a(reinterpret_cast<const u8*>(name.data()),name.size())); Keypad keys; int grain=opt.grain>0?opt.grain:opt.cycles;
+    for(int f=0;f<opt.frames;++f){
+      if(f%8==0){ keys.reset(); u32 c=input.below(chip8c::kKeyCount+1); if(c<chip8c::kKeyCount){ keys.set(u8(c),true); ref.feedKey(u8(c)); cand.feedKey(u8(c)); } }
+      const Chip8VM::Snapshot start=ref.snapshot();
+      for(int done=0;done<opt.cycles;){
+        int n=std::min(grain,opt.cycles-done); cand.run(keys,n); ref.run(keys,n); done+=n; instructions+=u64(n);
+        if(!same(ref,cand)){ report(name,f,start,ref,cand,keys,done); return false; }
+        if(opt.watch && !std::equal(refHits.begin(),refHits.end(),candHits.begin(),candHits.end(),sameHit)){
+          std::cout<<"DIVERGED "<<name<<" frame "<<f<<": watch hits ref="<<refHits.size()<<" got="<<candHits.size()<<"\n";
+          for(size_t i=0;i<std::max(refHits.size(),candHits.size());++i){
+            if(i<refHits.size() && i<candHits.size() && sameHit(refHits[i],candHits[i])) continue;
+            const Chip8VM::WatchHit& h=i<refHits.size()?refHits[i]:candHits[i];
+            std::cout<<"  first differing hit #"<<i<<" ("<<(i<refHits.size()?"missing from candidate":"extra in candidate")<<"): pc="<<std::hex<<h.pc
+                     <<" addr="<<h.addr<<std::dec<<(h.kind==Chip8VM::kWatchRead?" read":" write")<<"\n";
+            break;
+          }
+          return false;
+        }
+        refHits.clear(); candHits.clear();
+      }
+      ref.timerTick(); cand.timerTick();
+    }
+    return true;
+  }
+  // Replays the frame from `start` one instruction at a time; if every single step agrees, the bug only shows when
+  // the candidate runs several instructions at once, so the whole chunk is listed instead.
+  void report(const std::string& name,int frame,const Chip8VM::Snapshot& start,Chip8VM& ref,Chip8VM& cand,Keypad& keys,int upTo){
+    std::cout<<"DIVERGED "<<name<<" frame "<<frame<<"\n";
+    Chip8VM::Snapshot badRef=ref.snapshot(), badCand=cand.snapshot();
+    ref.restore(start); cand.restore(start);
+    for(int i=0;i<upTo;++i){
+      u16 pc=ref.state().pc, op=opAt(ref); cand.run(keys,1); ref.run(keys,1);
+      if(!same(ref,cand)){
+        std::cout<<"first bad instruction #"<<i<<" of the frame: "<<std::hex<<pc<<": "<<op<<std::dec<<"  "<<Chip8VM::disasm(op)<<"\n";
+        diff(ref,cand); return;
+      }
+    }
+    std::cout<<"single steps agree; chunk ending at instruction #"<<upTo<<" diverges only as a block:\n";
+    ref.restore(start);
+    for(int i=0;i<upTo;++i){ u16 pc=ref.state().pc, op=opAt(ref); std::cout<<"  "<<std::hex<<pc<<": "<<op<<std::dec<<"  "<<Chip8VM::disasm(op)<<"\n"; ref.run(keys,1); }
+    ref.restore(badRef); cand.restore(badCand); diff(ref,cand);
+  }
+  Opt opt; u64 instructions=0;
+};
+
+#ifdef CHIP8_HAVE_FORK
+// Runs a prefix once, then fork()s one child per input branch; children share the parent's VM copy-on-write
+// and report their end state over a pipe. At most `jobs` children are alive at a time.
+class Explorer {
+ public:
+  struct Opt{ std::string rom; int prefix=60, frames=120, depth=1, jobs=4, cycles=10; u64 seed=1; };
+  struct Result{ u32 branch=0; u16 pc=0; u64 fb=0, state=0; };
+  static constexpr int kChoices=chip8c::kKeyCount+1;
+  explicit Explorer(const Opt& o):opt(o){}
+  // Branch b runs with Rng::jobSeed(seed,b) and results are printed in branch order as soon as every earlier branch
+  // is in, so the output depends on the seed alone, not on jobs or on which child finishes first.
+  bool run(){
+    if(!vm.load(opt.rom)) return false;
+    vm.seed(opt.seed); vm.setBeep(false);
+    for(int f=0;f<opt.prefix;++f) vm.frame(keys,opt.cycles);
+    u32 branches=1; for(int d=0;d<opt.depth;++d) branches*=kChoices;
+    int fds[2]; if(pipe(fds)!=0){ std::perror("pipe"); return false; }
+    fcntl(fds[0],F_SETFL,O_NONBLOCK);
+    window.assign(size_t(opt.jobs)*4,Slot{}); children.clear(); next=0; done=0; fbs.clear(); fbs.reserve(branches);
+    bool ok=true;
+    for(u32 b=0;b<branches;++b){
+      while(children.size()>=size_t(opt.jobs) || b>=next+window.size()){ ok&=reap(); drain(fds[0]); }
+      std::cout.flush(); std::cerr.flush();
+      pid_t pid=fork();
+      if(pid<0){ std::perror("fork"); ok=false; break; }
+      if(pid==0){ close(fds[0]); vm.seed(Rng::jobSeed(opt.seed,b)); Result r=explore(b); r.branch=b; ssize_t w=write(fds[1],&r,sizeof r); _exit(w==sizeof r?0:1); }
+      children.push_back({pid,b});
+    }
+    close(fds[1]);
+    while(!children.empty()){ ok&=reap(); drain(fds[0]); }
+    drain(fds[0]); close(fds[0]);
+    std::sort(fbs.begin(),fbs.end()); size_t distinct=std::unique(fbs.begin(),fbs.end())-fbs.begin();
+    std::cout<<"explored "<<done<<"/"<<branches<<" branches, "<<distinct<<" distinct frames\n";
+    return ok && done==branches;
+  }
+ private:
+  // Reorder buffer: branch b waits in window[b%size] until branches below it are out; launching stops a window ahead.
+  struct Slot{ bool full=false, failed=false; Result r; };
+  struct Child{ pid_t pid; u32 branch; };
+  void settle(u32 branch,const Result* r){
+    Slot& s=window[branch%window.size()]; s.full=true; s.failed=!r; if(r) s.r=*r;
+    for(Slot* t=&window[next%window.size()]; t->full; t=&window[next%window.size()]){
+      if(t->failed) std::cout<<"branch "<<describe(next)<<" failed\n";
+      else { fbs.push_back(t->r.fb); ++done; std::cout<<"branch "<<describe(next)<<" pc="<<t->r.pc<<" fb="<<std::hex<<t->r.fb<<" state="<<t->r.state<<std::dec<<"\n"; }
+      *t=Slot{}; ++next;
+    }
+  }
+  Result explore(u32 branch){
+    for(int d=0;d<opt.depth;++d,branch/=kChoices){
+      u8 choice=branch%kChoices; keys.reset();
+      if(choice<chip8c::kKeyCount){ keys.set(choice,true); vm.feedKey(choice); }
+      for(int f=0;f<opt.frames;++f) vm.frame(keys,opt.cycles);
+    }
+    return Result{0,vm.state().pc,vm.fbHash(),vm.stateHash()};
+  }
+  std::string describe(u32 branch)const{
+    std::string s; for(int d=0;d<opt.depth;++d,branch/=kChoices){ u8 c=branch%kChoices; s+=c<chip8c::kKeyCount?"0123456789ABCDEF"[c]:'-'; }
+    return s;
+  }
+  // A child that fails never writes its result, so its slot is settled here once the pipe has been drained.
+  bool reap(){
+    int status=0; pid_t pid=waitpid(-1,&status,0); if(pid<0){ children.clear(); return false; }
+    auto c=std::find_if(children.begin(),children.end(),[&](const Child& x){ return x.pid==pid; }); if(c==children.end()) return true;
+    u32 branch=c->branch; children.erase(c);
+    if(WIFEXITED(status) && WEXITSTATUS(status)==0) return true;
+    settle(branch,nullptr); return false;
+  }
+  void drain(int fd){ Result r; while(read(fd,&r,sizeof r)==ssize_t(sizeof r)) settle(r.branch,&r); }
+  Opt opt; Keypad keys; Chip8VM vm; std::vector<Slot> window; std::vector<Child> children; std::vector<u64> fbs; u32 next=0, done=0;
+};
+#endif
+
+// Runs many VMs on one thread. Each VM's loop is a coroutine that suspends at every frame boundary until its next
+// 60 Hz deadline; on FX0A (blocking key waits) and when it is idle, it parks until input instead, waking for timer
+// ticks only while DT or ST still run. Idle means the end-of-frame state repeats one of the last few frames exactly
+// with nothing drawn, written or beeped in between, so with unchanged keys every later frame would repeat as well.
+// Only runnable VMs are resumed; a parked VM costs nothing. Use one Scheduler per core for multi-core hosts.
+class Scheduler {
+ public:
+  using Clock=std::chrono::steady_clock;
+  struct Task{
+    struct promise_type{
+      Task get_return_object(){ return Task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+      std::suspend_always initial_suspend()noexcept{ return {}; }
+      std::suspend_always final_suspend()noexcept{ return {}; }
+      void return_void(){}
+      void unhandled_exception(){ std::terminate(); }
+    };
+    explicit Task(std::coroutine_handle<promise_type> c):h(c){}
+    Task(Task&& o)noexcept:h(std::exchange(o.h,{})){}
+    Task& operator=(Task&&)=delete;
+    ~Task(){ if(h) h.destroy(); }
+    std::coroutine_handle<promise_type> h;
+  };
+  struct Stats{ u64 resumes=0, frames=0, keyWaits=0, idleParks=0, inputWakes=0; };
+  explicit Scheduler(int cycles=10):cycles(cycles){}
+  // Returns the new session's id, or -1 if the ROM does not load.
+  int add(const std::string& rom){
+    auto s=std::make_unique<Session>(); if(!s->vm.load(rom)) return -1;
+    s->vm.setBlockingKeyWait(true); s->vm.setBeep(false); s->id=int(sessions.size()); s->due=Clock::now();
+    s->task.emplace(life(*s)); ready.push_back(s.get()); sessions.push_back(std::move(s));
+    return sessions.back()->id;
+  }
+  void key(int id,u8 k,bool down){
+    Session& s=*sessions[size_t(id)]; s.keys.set(k,down); if(down) s.vm.feedKey(k);
+    s.nrecent=0; if(s.parked && s.onInput){ wake(s); ++stats.inputWakes; }
+  }
+  // Resumes runnable VMs until `until`, sleeping while none is due.
+  void runUntil(Clock::time_point until){
+    while(true){
+      Clock::time_point now=Clock::now();
+      while(!timers.empty() && timers.top().due<=now){ Timer t=timers.top(); timers.pop(); if(t.s->parked && t.s->gen==t.gen) wake(*t.s); }
+      if(now>=until) return;
+      if(!ready.empty()){ Session* s=ready.front(); ready.pop_front(); ++stats.resumes; s->task->h.resume(); continue; }
+      std::this_thread::sleep_until(timers.empty()?until:std::min(until,timers.top().due));
+    }
+  }
+  size_t parked()const{ size_t n=0; for(const auto& s:sessions) n+=s->parked; return n; }
+  size_t size()const{ return sessions.size(); }
+  const Chip8VM& vm(int id)const{ return sessions[size_t(id)]->vm; }
+  const Stats& statistics()const{ return stats; }
+ private:
+  // What decides the next frame besides memory (tracked through memWrites) and the keys.
+  struct Pulse{
+    std::array<u8,chip8c::kRegCount> v{}; std::array<u16,chip8c::kStackDepth> stack{}; u16 I=0, pc=0; u8 sp=0, DT=0; u64 rng=0;
+    bool operator==(const Pulse&)const=default;
+  };
+  static constexpr int kRecent=8;
+  struct Session{
+    int id=0; Chip8VM vm; Keypad keys; std::optional<Task> task; Clock::time_point due{}; u32 gen=0; bool parked=false, onInput=false;
+    std::array<Pulse,kRecent> recent{}; int nrecent=0, head=0;
+  };
+  struct Timer{ Clock::time_point due; Session* s; u32 gen; bool operator>(const Timer& o)const{ return due>o.due; } };
+  struct Park{
+    Scheduler& sch; Session& s; bool timed, input;
+    bool await_ready()const noexcept{ return false; }
+    void await_suspend(std::coroutine_handle<>)noexcept{ sch.park(s,timed,input); }
+    void await_resume()const noexcept{}
+  };
+  void park(Session& s,bool timed,bool input){ s.parked=true; s.onInput=input; ++s.gen; if(timed) timers.push(Timer{s.due,&s,s.gen}); }
+  void wake(Session& s){ s.parked=false; s.onInput=false; ++s.gen; ready.push_back(&s); }
+  bool idle(Session& s,bool draw,u64 writes){
+    const auto& st=s.vm.state(); Pulse p{st.v,st.stack,st.I,st.pc,st.sp,st.DT,s.vm.rngState()};
+    if(draw || st.ST || s.vm.statistics().memWrites!=writes) s.nrecent=0;
+    else for(int i=0;i<s.nrecent;++i) if(s.recent[i]==p){ s.nrecent=0; return true; }
+    s.recent[s.head]=p; s.head=(s.head+1)%kRecent; s.nrecent=std::min(s.nrecent+1,kRecent);
+    return false;
+  }
+  Task life(Session& s){
+    const auto period=std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1))/chip8c::kTimerHz;
+    while(true){
+      u64 writes=s.vm.statistics().memWrites; bool draw=s.vm.frame(s.keys,cycles); ++stats.frames;
+      Clock::time_point now=Clock::now(); s.due=std::max(s.due+period,now-period);
+      bool timers=s.vm.state().DT || s.vm.state().ST;
+      if(s.vm.blocked()){ ++stats.keyWaits; s.nrecent=0; co_await Park{*this,s,timers,true}; }
+      else if(idle(s,draw,writes)){ ++stats.idleParks; co_await Park{*this,s,false,true}; s.due=Clock::now(); }
+      else co_await Park{*this,s,true,false};
+    }
+  }
+  int cycles; Stats stats{};
+  std::vector<std::unique_ptr<Session>> sessions; std::deque<Session*> ready;
+  std::priority_queue<Timer,std::vector<Timer>,std::greater<Timer>> timers;
+};
+
+// Serves `vms` copies of a ROM from one Scheduler for a while, with simulated users pressing random keys.
+class Server {
+ public:
+  struct Opt{ std::string rom; int vms=1000, seconds=5, inputsPerSecond=100, cycles=10; };
+  explicit Server(const Opt& o):opt(o),sch(o.cycles){}
+  bool run(){
+    using Clock=Scheduler::Clock;
+    for(int i=0;i<opt.vms;++i) if(sch.add(opt.rom)<0) return false;
+    std::vector<int> held(size_t(opt.vms),-1); Rng users(1);
+    Clock::time_point start=Clock::now(), end=start+std::chrono::seconds(opt.seconds), next=start;
+    const auto gap=std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1))/std::max(1,opt.inputsPerSecond);
+    while(Clock::now()<end){
+      sch.runUntil(std::min(end,next));
+      if(Clock::now()<next) continue;
+      int id=int(users.below(u32(opt.vms))); u8 k=u8(users.below(chip8c::kKeyCount));
+      if(held[size_t(id)]>=0) sch.key(id,u8(held[size_t(id)]),false);
+      sch.key(id,k,true); held[size_t(id)]=k; next+=gap;
+    }
+    double secs=std::chrono::duration<double>(Clock::now()-start).count(); const auto& s=sch.statistics();
+    std::cout<<"serve: "<<opt.vms<<" VMs for "<<secs<<"s frames="<<s.frames<<" ("<<s.frames/secs<<"/s) resumes="<<s.resumes
+             <<" key_waits="<<s.keyWaits<<" idle_parks="<<s.idleParks<<" input_wakes="<<s.inputWakes<<" parked_now="<<sch.parked()<<"\n";
+    return true;
+  }
+ private: Opt opt; Scheduler sch;
+};
+
+static void usage(const char* a){
+  std::cout<<"Usage: "<<a<<" <rom_path> [scale] [record_path]\n"
+           <<"       "<<a<<" --headless <rom_path> [frames] [step|fast|jit|tiered] [memo_verify_every]\n"
+           <<"       "<<a<<" --explore <rom_path> [depth] [jobs] [seed]\n"
+           <<"       "<<a<<" --lockstep <fast|jit|tiered> <frames> <grain> <rom_path|random:count|hex:bytes|watch>...\n"
+           <<"       "<<a<<" --serve <rom_path> [vms] [seconds]\n"
+           <<"       "<<a<<" --render <rom_path> <recording> <out.y4m> [scale] [workers] [checkpoint_every]\n"
+           <<"       "<<a<<" --watch <rom_path> <expression> [frames] [instances]\n"
+           <<"       "<<a<<" --env <rom_path> <reward_expression> [envs] [steps] [done_expression] [downsample]\n"
+           <<"       "<<a<<" --novelty <rom_path> [frames] [threads] [cell_expression] [score_expression]\n"
+           <<"       "<<a<<" --coverage <rom_path> [frames] [instances] [report_every] [patience] [step|fast|jit|tiered]\n"
+           <<"       "<<a<<" --debug <rom_path> <frames> <step|fast|jit|tiered> <addr[:condition]|r:|w:|rw:addr[-last]>...\n"
+           <<"       "<<a<<" --profile <rom_path> <out.folded> [frames] [period] [symbol_file]\n"
+           <<"       "<<a<<" --scan <telemetry_file> <column>\n"
+           <<"       "<<a<<" --pipeline <rom_path> <out_dir> [sessions] [frames] [emulate,post,encode,write threads]\n";
+}
 
 int main(int argc,char** argv){
   if(argc<2){ usage(argv[0]); return 1; }
+  std::string_view mode=argv[1];
+  if(mode=="--headless"){
+    if(argc<3){ usage(argv[0]); return 1; }
+    Headless::Opt h; h.rom=argv[2]; if(argc>=4) h.frames=std::max(1,std::atoi(argv[3]));
+    if(argc>=5){ auto e=Chip8VM::engineByName(argv[4]); if(!e){ usage(argv[0]); return 1; } h.engine=*e; }
+    if(argc>=6) h.memoVerify=std::max(0,std::atoi(argv[5]));
+    Headless run(h); return run.run()?0:2;
+  }
+  if(mode=="--lockstep"){
+    if(argc<6){ usage(argv[0]); return 1; }
+    Lockstep::Opt l; auto e=Chip8VM::engineByName(argv[2]); if(!e){ usage(argv[0]); return 1; }
+    l.engine=*e; l.frames=std::max(1,std::atoi(argv[3])); l.grain=std::max(0,std::atoi(argv[4]));
+    for(int i=5;i<argc;++i){ if(std::string_view(argv[i])=="watch") l.watch=true; else l.roms.push_back(argv[i]); }
+    Lockstep run(l); return run.run()?0:2;
+  }
+  if(mode=="--serve"){
+    if(argc<3){ usage(argv[0]); return 1; }
+    Server::Opt o; o.rom=argv[2]; if(argc>=4) o.vms=clamp(std::atoi(argv[3]),1,1<<20); if(argc>=5) o.seconds=clamp(std::atoi(argv[4]),1,3600);
+    Server run(o); return run.run()?0:2;
+  }
+  if(mode=="--render"){
+#ifdef CHIP8_HAVE_POSIX_IO
+    if(argc<5){ usage(argv[0]); return 1; }
+    Renderer::Opt r; r.rom=argv[2]; r.recording=argv[3]; r.out=argv[4];
+    if(argc>=6) r.scale=clamp(std::atoi(argv[5]),1,16);
+    if(argc>=7) r.workers=clamp(std::atoi(argv[6]),0,1024);
+    if(argc>=8) r.every=clamp(std::atoi(argv[7]),1,1<<20);
+    Renderer run(r); return run.run()?0:2;
+#else
+    std::cerr<<"--render needs POSIX files\n"; return 1;
+#endif
+  }
+  if(mode=="--watch"){
+    if(argc<4){ usage(argv[0]); return 1; }
+    WatchRun::Opt o; o.rom=argv[2]; o.expr=argv[3];
+    if(argc>=5) o.frames=clamp(std::atoi(argv[4]),1,1<<24);
+    if(argc>=6) o.instances=clamp(std::atoi(argv[5]),1,1<<16);
+    WatchRun run(o); return run.run()?0:2;
+  }
+  if(mode=="--env"){
+    if(argc<4){ usage(argv[0]); return 1; }
+    EnvRun::Opt o; o.env.rom=argv[2]; o.env.reward=argv[3];
+    if(argc>=5) o.env.envs=clamp(std::atoi(argv[4]),1,1<<16);
+    if(argc>=6) o.steps=clamp(std::atoi(argv[5]),1,1<<24);
+    if(argc>=7) o.env.done=argv[6];
+    if(argc>=8) o.env.obs.downsample=std::atoi(argv[7]);
+    EnvRun run(o); return run.run()?0:2;
+  }
+  if(mode=="--novelty"){
+    if(argc<3){ usage(argv[0]); return 1; }
+    Novelty::Opt o; o.rom=argv[2];
+    if(argc>=4) o.frames=std::max<u64>(1,std::strtoull(argv[3],nullptr,10));
+    if(argc>=5) o.threads=clamp(std::atoi(argv[4]),0,1024);
+    if(argc>=6) o.cell=argv[5];
+    if(argc>=7) o.score=argv[6];
+    Novelty run(o); return run.run()?0:2;
+  }
+  if(mode=="--coverage"){
+    if(argc<3){ usage(argv[0]); return 1; }
+    Coverage::Opt o; o.rom=argv[2];
+    if(argc>=4) o.frames=clamp(std::atoi(argv[3]),1,1<<30);
+    if(argc>=5) o.instances=clamp(std::atoi(argv[4]),1,1<<16);
+    if(argc>=6) o.every=clamp(std::atoi(argv[5]),1,1<<30);
+    if(argc>=7) o.patience=clamp(std::atoi(argv[6]),0,1<<20);
+    if(argc>=8){ auto e=Chip8VM::engineByName(argv[7]); if(!e){ usage(argv[0]); return 1; } o.engine=*e; }
+    Coverage run(o); return run.run()?0:2;
+  }
+  if(mode=="--debug"){
+    if(argc<6){ usage(argv[0]); return 1; }
+    Debugger::Opt o; o.rom=argv[2]; o.frames=clamp(std::atoi(argv[3]),1,1<<30);
+    auto e=Chip8VM::engineByName(argv[4]); if(!e){ usage(argv[0]); return 1; } o.engine=*e;
+    for(int i=5;i<argc;++i) o.breaks.push_back(argv[i]);
+    Debugger run(o); return run.run()?0:2;
+  }
+  if(mode=="--profile"){
+    if(argc<4){ usage(argv[0]); return 1; }
+    Profiler::Opt o; o.rom=argv[2]; o.out=argv[3];
+    if(argc>=5) o.frames=clamp(std::atoi(argv[4]),1,1<<30);
+    if(argc>=6) o.period=clamp(std::atoi(argv[5]),1,1<<30);
+    if(argc>=7) o.symbols=argv[6];
+    Profiler run(o); return run.run()?0:2;
+  }
+  if(mode=="--scan"){
+#ifdef CHIP8_HAVE_POSIX_IO
+    if(argc<4){ usage(argv[0]); return 1; }
+    TelemetryReader r; if(!r.open(argv[2])) return 2;
+    int c=r.find(argv[3]); if(c<0){ std::cerr<<"no column "<<argv[3]<<"\n"; return 2; }
+    u64 n=0, lo=~0ull, hi=0, changes=0, prev=0; long double sum=0; auto t0=std::chrono::steady_clock::now();
+    bool ok=r.scan(c,[&](u64 v){ if(n && v!=prev) ++changes; prev=v; lo=std::min(lo,v); hi=std::max(hi,v); sum+=v; ++n; });
+    double ns=std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now()-t0).count();
+    if(!ok){ std::cerr<<"corrupt column "<<argv[3]<<"\n"; return 2; }
+    std::cout<<argv[3]<<": rows="<<n<<" blocks="<<r.index(c).size()<<" min="<<(n?lo:0)<<" max="<<hi<<" mean="<<double(n?sum/n:0)<<" changes="<<changes<<" ns/value="<<(n?ns/double(n):0)<<"\n";
+    return 0;
+#else
+    std::cerr<<"--scan needs POSIX files\n"; return 1;
+#endif
+  }
+  if(mode=="--pipeline"){
+#ifdef CHIP8_HAVE_POSIX_IO
+    if(argc<4){ usage(argv[0]); return 1; }
+    Pipeline::Opt o; o.rom=argv[2]; o.dir=argv[3];
+    if(argc>=5) o.sessions=clamp(std::atoi(argv[4]),1,1<<16);
+    if(argc>=6) o.frames=clamp(std::atoi(argv[5]),1,1<<24);
+    if(argc>=7){ int t[Pipeline::kStageCount]{}; if(std::sscanf(argv[6],"%d,%d,%d,%d",&t[0],&t[1],&t[2],&t[3])!=4){ usage(argv[0]); return 1; } for(int i=0;i<Pipeline::kStageCount;++i) o.threads[size_t(i)]=clamp(t[i],1,256); }
+    Pipeline run(o); return run.run()?0:2;
+#else
+    std::cerr<<"--pipeline needs POSIX files\n"; return 1;
+#endif
+  }
+  if(mode=="--explore"){
+#ifdef CHIP8_HAVE_FORK
+    if(argc<3){ usage(argv[0]); return 1; }
+    Explorer::Opt e; e.rom=argv[2]; if(argc>=4) e.depth=clamp(std::atoi(argv[3]),1,4); if(argc>=5) e.jobs=clamp(std::atoi(argv[4]),1,1024); if(argc>=6) e.seed=std::strtoull(argv[5],nullptr,0);
+    Explorer run(e); return run.run()?0:2;
+#else
+    std::cerr<<"--explore needs fork()\n"; return 1;
+#endif
+  }
   std::string rom=argv[1]; int scale= (argc>=3? clamp(std::atoi(argv[2]),1,64):12);
-  App::Opt o; o.rom=rom; o.sx=scale; o.sy=scale; o.timerHz=chip8c::kTimerHz; o.cycles=10; o.vsync=true;
+  App::Opt o; o.rom=rom; o.sx=scale; o.sy=scale; if(argc>=4) o.record=argv[3]; o.timerHz=chip8c::kTimerHz; o.cycles=10; o.vsync=true;
   App app(o); if(!app.run()){ std::cerr<<"Run failed.\n"; return 2; } return 0;
 }
@@ -0,0 +1,63 @@
+# JIT translation cache round trip, run by ctest as: cmake -DCHIP8=<exe> -DROM=<rom> -DDIR=<scratch dir> -P jit_cache.cmake
+# A cold run writes the entry and a warm run maps it; both must end in the interpreter's state. An entry with one
+# byte changed must be rejected and rebuilt, again without changing the result.
+file(REMOVE_RECURSE ${DIR})
+file(MAKE_DIRECTORY ${DIR})
+
+# The interpreter runs without the cache, which it would otherwise fill with its heat profile.
+function(headless engine expect out)
+  set(cache CHIP8_JIT_CACHE=${DIR})
+  if(engine STREQUAL "step")
+    set(cache)
+  endif()
+  execute_process(COMMAND ${CMAKE_COMMAND} -E env ${cache} ${CHIP8} --headless ${ROM} 600 ${engine}
+                  OUTPUT_VARIABLE log ERROR_VARIABLE err RESULT_VARIABLE rc)
+  if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "${engine} run failed (${rc}):\n${log}${err}")
+  endif()
+  if(expect AND NOT log MATCHES "jit cache: ${expect}")
+    message(FATAL_ERROR "expected a ${expect} cache:\n${log}${err}")
+  endif()
+  string(REGEX MATCH "fb_digest=[0-9a-f]+ state=[0-9a-f]+" digest "${log}")
+  set(${out} "${digest}" PARENT_SCOPE)
+  set(${out}_err "${err}" PARENT_SCOPE)
+endfunction()
+
+function(same name got want)
+  if(NOT got STREQUAL want)
+    message(FATAL_ERROR "${name}: ${got}, interpreter: ${want}")
+  endif()
+endfunction()
+
+headless(step "" reference)
+headless(jit cold cold)
+same("cold run" "${cold}" "${reference}")
+headless(jit warm warm)
+same("warm run" "${warm}" "${reference}")
+
+file(GLOB entries ${DIR}/*.jit)
+list(LENGTH entries n)
+if(NOT n EQUAL 1)
+  message(FATAL_ERROR "expected one cache entry, found: ${entries}")
+endif()
+file(SIZE ${entries} size)
+math(EXPR at "${size} - 64")
+file(READ ${entries} byte OFFSET ${at} LIMIT 1 HEX)
+if(byte STREQUAL "00")
+  set(flip "\\377")
+else()
+  set(flip "\\000")
+endif()
+execute_process(COMMAND sh -c "printf '${flip}' | dd of='${entries}' bs=1 seek=${at} conv=notrunc 2>/dev/null" RESULT_VARIABLE rc)
+file(READ ${entries} changed OFFSET ${at} LIMIT 1 HEX)
+if(NOT rc EQUAL 0 OR changed STREQUAL byte)
+  message(FATAL_ERROR "could not corrupt ${entries}")
+endif()
+
+headless(jit cold corrupt)
+if(NOT corrupt_err MATCHES "ignoring invalid")
+  message(FATAL_ERROR "corrupted entry was not reported:\n${corrupt_err}")
+endif()
+same("run after corruption" "${corrupt}" "${reference}")
+headless(jit warm rebuilt)
+same("run on the rebuilt entry" "${rebuilt}" "${reference}")